@@ -0,0 +1,711 @@
+// Opcode handlers and dispatch tables for the CPU
+// Every opcode of the SM83 gets an entry in one of two 256 entry tables, the base table and the 0xCB prefixed table
+// Handlers are templates on their operands (register index, ALU operation, bit number, condition) and the tables
+// are built at compile time, so each entry is a specialized function with no operand decoding left in it
+#include "CPU.h"
+
+#include <array>
+#include <cstring>
+#include <utility>
+
+#include "jit.h"
+#include "trace.h"
+
+namespace {
+
+using Handler = void (*)(CPU&);
+
+// Misc / control ________________________________________________________________________________________________________
+void op_nop(CPU&) {}
+
+template <uint8_t opcode>
+void op_illegal(CPU& cpu) {
+    // These opcodes lock up the real hardware, we just log it and keep going. A ROM that runs into them tends to do it
+    // over and over, so the message is rate limited
+    MCGB_ERROR_LIMITED("Em CPU::execute: Opcode ilegal 0x{:02X} em PC 0x{:04X} |-> {}, line {}", opcode, (uint16_t)(cpu.reg.pc - 1), __FILE_NAME__, __LINE__);
+}
+
+void op_stop(CPU&, uint8_t) {}    // STOP is 2 bytes long, the second one is ignored
+
+void op_halt(CPU& cpu) {
+    cpu.halted = true;
+}
+
+void op_di(CPU& cpu) {
+    cpu.ime = false;
+    cpu.ime_pending = false;
+}
+
+void op_ei(CPU& cpu) {
+    cpu.ime_pending = true;
+}
+
+void op_daa(CPU& cpu) { cpu.daa(); }
+
+void op_cpl(CPU& cpu) {
+    cpu.reg.a = ~cpu.reg.a;
+    cpu.reg.f.from_uint8(cpu.reg.f.to_uint8() | FlagsRegister::SUBTRACTION | FlagsRegister::HALF_CARRY);
+}
+
+void op_scf(CPU& cpu) {
+    cpu.reg.f.from_uint8((cpu.reg.f.zero() ? FlagsRegister::ZERO : 0) | FlagsRegister::CARRY);
+}
+
+void op_ccf(CPU& cpu) {
+    cpu.reg.f.from_uint8((cpu.reg.f.zero() ? FlagsRegister::ZERO : 0) | (cpu.reg.f.carry() ? 0 : FlagsRegister::CARRY));
+}
+
+// Accumulator rotates always clear zero, unlike their 0xCB counterparts
+void op_rlca(CPU& cpu) { cpu.reg.a = cpu.rlc(cpu.reg.a); cpu.reg.f.known &= ~FlagsRegister::ZERO; }
+void op_rrca(CPU& cpu) { cpu.reg.a = cpu.rrc(cpu.reg.a); cpu.reg.f.known &= ~FlagsRegister::ZERO; }
+void op_rla(CPU& cpu)  { cpu.reg.a = cpu.rl(cpu.reg.a);  cpu.reg.f.known &= ~FlagsRegister::ZERO; }
+void op_rra(CPU& cpu)  { cpu.reg.a = cpu.rr(cpu.reg.a);  cpu.reg.f.known &= ~FlagsRegister::ZERO; }
+
+// 8 bit loads ___________________________________________________________________________________________________________
+template <uint8_t dst, uint8_t src>
+void op_ld_r_r(CPU& cpu) {
+    cpu.set_r8<dst>(cpu.get_r8<src>());
+}
+
+template <uint8_t dst>
+void op_ld_r_d8(CPU& cpu, uint8_t value) {
+    cpu.set_r8<dst>(value);
+}
+
+// LD (BC),A / LD (DE),A / LD (HL+),A / LD (HL-),A
+template <uint8_t mode>
+void op_ld_ind_a(CPU& cpu) {
+    if constexpr (mode == 0) {
+        cpu.write8(cpu.reg.get_bc(), cpu.reg.a);
+    } else if constexpr (mode == 1) {
+        cpu.write8(cpu.reg.get_de(), cpu.reg.a);
+    } else {
+        uint16_t hl = cpu.reg.get_hl();
+        cpu.write8(hl, cpu.reg.a);
+        cpu.reg.set_hl(mode == 2 ? hl + 1 : hl - 1);
+    }
+}
+
+// LD A,(BC) / LD A,(DE) / LD A,(HL+) / LD A,(HL-)
+template <uint8_t mode>
+void op_ld_a_ind(CPU& cpu) {
+    if constexpr (mode == 0) {
+        cpu.reg.a = cpu.read8(cpu.reg.get_bc());
+    } else if constexpr (mode == 1) {
+        cpu.reg.a = cpu.read8(cpu.reg.get_de());
+    } else {
+        uint16_t hl = cpu.reg.get_hl();
+        cpu.reg.a = cpu.read8(hl);
+        cpu.reg.set_hl(mode == 2 ? hl + 1 : hl - 1);
+    }
+}
+
+void op_ldh_a8_a(CPU& cpu, uint8_t offset) { cpu.write8(0xFF00 | offset, cpu.reg.a); }
+void op_ldh_a_a8(CPU& cpu, uint8_t offset) { cpu.reg.a = cpu.read8(0xFF00 | offset); }
+void op_ldh_c_a(CPU& cpu)  { cpu.write8(0xFF00 | cpu.reg.c, cpu.reg.a); }
+void op_ldh_a_c(CPU& cpu)  { cpu.reg.a = cpu.read8(0xFF00 | cpu.reg.c); }
+void op_ld_a16_a(CPU& cpu, uint16_t address) { cpu.write8(address, cpu.reg.a); }
+void op_ld_a_a16(CPU& cpu, uint16_t address) { cpu.reg.a = cpu.read8(address); }
+
+// 16 bit loads / arithmetic _____________________________________________________________________________________________
+template <uint8_t rp>
+void op_ld_rp_d16(CPU& cpu, uint16_t value) {
+    cpu.set_rp<rp>(value);
+}
+
+void op_ld_a16_sp(CPU& cpu, uint16_t address) {
+    cpu.write8(address, (uint8_t)(cpu.reg.sp & 0x00FF));
+    cpu.write8(address + 1, (uint8_t)(cpu.reg.sp >> 8));
+}
+
+void op_ld_sp_hl(CPU& cpu) { cpu.reg.sp = cpu.reg.get_hl(); }
+void op_ld_hl_sp_e8(CPU& cpu, uint8_t offset) { cpu.reg.set_hl(cpu.add_sp((int8_t)offset)); }
+void op_add_sp_e8(CPU& cpu, uint8_t offset) { cpu.reg.sp = cpu.add_sp((int8_t)offset); }
+
+template <uint8_t rp>
+void op_inc_rp(CPU& cpu) {
+    cpu.set_rp<rp>(cpu.get_rp<rp>() + 1);
+}
+
+template <uint8_t rp>
+void op_dec_rp(CPU& cpu) {
+    cpu.set_rp<rp>(cpu.get_rp<rp>() - 1);
+}
+
+template <uint8_t rp>
+void op_add_hl_rp(CPU& cpu) {
+    cpu.addhl(cpu.get_rp<rp>());
+}
+
+// PUSH/POP use AF instead of SP as the 4th pair
+template <uint8_t rp>
+void op_push(CPU& cpu) {
+    if constexpr (rp == 3) {
+        cpu.push16(cpu.reg.get_af());
+    } else {
+        cpu.push16(cpu.get_rp<rp>());
+    }
+}
+
+template <uint8_t rp>
+void op_pop(CPU& cpu) {
+    uint16_t value = cpu.pop16();
+    if constexpr (rp == 3) {
+        cpu.reg.set_af(value);
+    } else {
+        cpu.set_rp<rp>(value);
+    }
+}
+
+// 8 bit arithmetic ______________________________________________________________________________________________________
+template <uint8_t r>
+void op_inc_r(CPU& cpu) {
+    cpu.set_r8<r>(cpu.inc(cpu.get_r8<r>()));
+}
+
+template <uint8_t r>
+void op_dec_r(CPU& cpu) {
+    cpu.set_r8<r>(cpu.dec(cpu.get_r8<r>()));
+}
+
+// Bits 5-3 of the opcode select the operation: ADD ADC SUB SBC AND XOR OR CP
+template <uint8_t operation>
+void alu(CPU& cpu, uint8_t value) {
+    if constexpr (operation == 0) cpu.add(value);
+    else if constexpr (operation == 1) cpu.adc(value);
+    else if constexpr (operation == 2) cpu.sub(value);
+    else if constexpr (operation == 3) cpu.sbc(value);
+    else if constexpr (operation == 4) cpu.bitwise_and(value);
+    else if constexpr (operation == 5) cpu.bitwise_xor(value);
+    else if constexpr (operation == 6) cpu.bitwise_or(value);
+    else cpu.compare(value);
+}
+
+template <uint8_t operation, uint8_t r>
+void op_alu_r(CPU& cpu) {
+    alu<operation>(cpu, cpu.get_r8<r>());
+}
+
+template <uint8_t operation>
+void op_alu_d8(CPU& cpu, uint8_t value) {
+    alu<operation>(cpu, value);
+}
+
+// Jumps / calls _________________________________________________________________________________________________________
+void op_jr(CPU& cpu, uint8_t offset) {
+    cpu.reg.pc = (uint16_t)(cpu.reg.pc + (int8_t)offset);
+}
+
+template <uint8_t cc>
+void op_jr_cc(CPU& cpu, uint8_t offset) {
+    if (cpu.condition<cc>()) {
+        cpu.reg.pc = (uint16_t)(cpu.reg.pc + (int8_t)offset);
+        cpu.cycles += 4;    // Taken branches take longer, the cycle table has the not taken count
+    }
+}
+
+void op_jp(CPU& cpu, uint16_t address) { cpu.reg.pc = address; }
+void op_jp_hl(CPU& cpu) { cpu.reg.pc = cpu.reg.get_hl(); }
+
+template <uint8_t cc>
+void op_jp_cc(CPU& cpu, uint16_t address) {
+    if (cpu.condition<cc>()) {
+        cpu.reg.pc = address;
+        cpu.cycles += 4;
+    }
+}
+
+void op_call(CPU& cpu, uint16_t address) {
+    cpu.push16(cpu.reg.pc);
+    cpu.reg.pc = address;
+}
+
+template <uint8_t cc>
+void op_call_cc(CPU& cpu, uint16_t address) {
+    if (cpu.condition<cc>()) {
+        cpu.push16(cpu.reg.pc);
+        cpu.reg.pc = address;
+        cpu.cycles += 12;
+    }
+}
+
+void op_ret(CPU& cpu) { cpu.reg.pc = cpu.pop16(); }
+
+template <uint8_t cc>
+void op_ret_cc(CPU& cpu) {
+    if (cpu.condition<cc>()) {
+        cpu.reg.pc = cpu.pop16();
+        cpu.cycles += 12;
+    }
+}
+
+void op_reti(CPU& cpu) {
+    cpu.reg.pc = cpu.pop16();
+    cpu.ime = true;
+}
+
+template <uint8_t vector>
+void op_rst(CPU& cpu) {
+    cpu.push16(cpu.reg.pc);
+    cpu.reg.pc = vector;
+}
+
+void op_prefix_cb(CPU& cpu, uint8_t opcode);
+
+// 0xCB page ____________________________________________________________________________________________________________
+// Bits 5-3 select the operation: RLC RRC RL RR SLA SRA SWAP SRL
+template <uint8_t operation, uint8_t r>
+void cb_shift(CPU& cpu) {
+    uint8_t value = cpu.get_r8<r>();
+    if constexpr (operation == 0) value = cpu.rlc(value);
+    else if constexpr (operation == 1) value = cpu.rrc(value);
+    else if constexpr (operation == 2) value = cpu.rl(value);
+    else if constexpr (operation == 3) value = cpu.rr(value);
+    else if constexpr (operation == 4) value = cpu.sla(value);
+    else if constexpr (operation == 5) value = cpu.sra(value);
+    else if constexpr (operation == 6) value = cpu.swap(value);
+    else value = cpu.srl(value);
+    cpu.set_r8<r>(value);
+}
+
+template <uint8_t bit, uint8_t r>
+void cb_bit(CPU& cpu) {
+    cpu.bit(bit, cpu.get_r8<r>());
+}
+
+template <uint8_t bit, uint8_t r>
+void cb_res(CPU& cpu) {
+    cpu.set_r8<r>(cpu.get_r8<r>() & (uint8_t)~(1 << bit));
+}
+
+template <uint8_t bit, uint8_t r>
+void cb_set(CPU& cpu) {
+    cpu.set_r8<r>(cpu.get_r8<r>() | (uint8_t)(1 << bit));
+}
+
+// Tables ________________________________________________________________________________________________________________
+// Opcodes are picked apart with the usual x/y/z split of the opcode byte
+// x = bits 7-6, y = bits 5-3 (p = bits 5-4, q = bit 3), z = bits 2-0
+
+// Bytes per instruction, opcode included (for 0xCB that's the prefix and the second opcode byte)
+constexpr uint8_t instruction_length(uint8_t op) {
+    uint8_t x = op >> 6;
+    uint8_t y = (op >> 3) & 7;
+    uint8_t z = op & 7;
+    if (x == 0) {
+        if (z == 0) return y == 0 ? 1 : y == 1 ? 3 : 2;        // LD (a16),SP / STOP, JR, JR cc
+        if (z == 1) return (y & 1) ? 1 : 3;                     // LD rr,d16
+        if (z == 6) return 2;                                   // LD r,d8
+    } else if (x == 3) {
+        if (z == 0) return y < 4 ? 1 : 2;                       // LDH, ADD SP,e8, LD HL,SP+e8
+        if (z == 2) return (y < 4 || y == 5 || y == 7) ? 3 : 1; // JP cc, LD (a16),A, LD A,(a16)
+        if (z == 3) return y == 0 ? 3 : y == 1 ? 2 : 1;         // JP, prefix
+        if (z == 4) return y < 4 ? 3 : 1;                       // CALL cc
+        if (z == 5) return y == 1 ? 3 : 1;                      // CALL
+        if (z == 6) return 2;                                   // ALU A,d8
+    }
+    return 1;
+}
+
+// Instructions after which the next one isn't the one that follows in memory, or interrupts may start being taken:
+// jumps, calls, returns, RST, HALT, STOP, EI and the illegal opcodes. The block cache ends its blocks on them
+constexpr bool ends_block(uint8_t op) {
+    uint8_t x = op >> 6;
+    uint8_t y = (op >> 3) & 7;
+    uint8_t z = op & 7;
+    if (x == 0) return z == 0 && y >= 2;
+    if (x == 1) return op == 0x76;
+    if (x == 2) return false;
+    switch (z) {
+        case 0  : return y < 4;                         // RET cc
+        case 1  : return y == 1 || y == 3 || y == 5;    // RET, RETI, JP HL
+        case 2  : return y < 4;                         // JP cc
+        case 3  : return y != 1 && y != 6;              // JP, EI, illegal
+        case 4  : return true;                          // CALL cc, illegal
+        case 5  : return y & 1;                         // CALL, illegal
+        case 6  : return false;
+        default : return true;                          // RST
+    }
+}
+
+// Handlers of the instructions with an immediate operand, which they take as an argument
+template <uint8_t op>
+constexpr auto immediate_handler() {
+    constexpr uint8_t x = op >> 6;
+    constexpr uint8_t y = (op >> 3) & 7;
+    constexpr uint8_t z = op & 7;
+    constexpr uint8_t p = y >> 1;
+
+    if constexpr (instruction_length(op) == 2) {
+        using D8 = void (*)(CPU&, uint8_t);
+        if constexpr (x == 0 && z == 0) {
+            if constexpr (y == 2) return D8{op_stop};
+            else if constexpr (y == 3) return D8{op_jr};
+            else return D8{op_jr_cc<y - 4>};
+        }
+        else if constexpr (x == 0) return D8{op_ld_r_d8<y>};
+        else if constexpr (z == 0) {
+            constexpr D8 misc[4] = {op_ldh_a8_a, op_add_sp_e8, op_ldh_a_a8, op_ld_hl_sp_e8};
+            return misc[y - 4];
+        }
+        else if constexpr (z == 3) return D8{op_prefix_cb};
+        else return D8{op_alu_d8<y>};
+    } else {
+        using D16 = void (*)(CPU&, uint16_t);
+        if constexpr (x == 0) {
+            if constexpr (z == 0) return D16{op_ld_a16_sp};
+            else return D16{op_ld_rp_d16<p>};
+        } else if constexpr (z == 2) {
+            if constexpr (y < 4) return D16{op_jp_cc<y>};
+            else if constexpr (y == 5) return D16{op_ld_a16_a};
+            else return D16{op_ld_a_a16};
+        }
+        else if constexpr (z == 3) return D16{op_jp};
+        else if constexpr (z == 4) return D16{op_call_cc<y>};
+        else return D16{op_call};
+    }
+}
+
+// The interpreter fetches the operand from PC first
+template <uint8_t op>
+void with_immediate(CPU& cpu) {
+    constexpr auto handler = immediate_handler<op>();
+    if constexpr (instruction_length(op) == 2) handler(cpu, cpu.fetch8());
+    else handler(cpu, cpu.fetch16());
+}
+
+// Picks the specialization for an opcode
+template <uint8_t op>
+constexpr Handler base_handler() {
+    constexpr uint8_t x = op >> 6;
+    constexpr uint8_t y = (op >> 3) & 7;
+    constexpr uint8_t z = op & 7;
+    constexpr uint8_t p = y >> 1;
+    constexpr uint8_t q = y & 1;
+
+    // What's left below has no operand
+    if constexpr (instruction_length(op) > 1) {
+        return with_immediate<op>;
+    } else if constexpr (x == 1) {
+        if constexpr (op == 0x76) return op_halt;     // LD (HL),(HL) slot
+        else return op_ld_r_r<y, z>;
+    } else if constexpr (x == 2) {
+        return op_alu_r<y, z>;
+    } else if constexpr (x == 0) {
+        if constexpr (z == 0) return op_nop;
+        else if constexpr (z == 1) return op_add_hl_rp<p>;
+        else if constexpr (z == 2) {
+            if constexpr (q == 0) return op_ld_ind_a<p>;
+            else return op_ld_a_ind<p>;
+        } else if constexpr (z == 3) {
+            if constexpr (q == 0) return op_inc_rp<p>;
+            else return op_dec_rp<p>;
+        }
+        else if constexpr (z == 4) return op_inc_r<y>;
+        else if constexpr (z == 5) return op_dec_r<y>;
+        else {
+            constexpr Handler misc[8] = {op_rlca, op_rrca, op_rla, op_rra, op_daa, op_cpl, op_scf, op_ccf};
+            return misc[y];
+        }
+    } else {
+        if constexpr (z == 0) return op_ret_cc<y>;
+        else if constexpr (z == 1) {
+            if constexpr (q == 0) return op_pop<p>;
+            else {
+                constexpr Handler misc[4] = {op_ret, op_reti, op_jp_hl, op_ld_sp_hl};
+                return misc[p];
+            }
+        } else if constexpr (z == 2) {
+            if constexpr (y == 4) return op_ldh_c_a;
+            else return op_ldh_a_c;
+        } else if constexpr (z == 3) {
+            if constexpr (y == 6) return op_di;
+            else if constexpr (y == 7) return op_ei;
+            else return op_illegal<op>;
+        }
+        else if constexpr (z == 4) return op_illegal<op>;
+        else if constexpr (z == 5) {
+            if constexpr (q == 0) return op_push<p>;
+            else return op_illegal<op>;
+        }
+        else return op_rst<y * 8>;
+    }
+}
+
+template <uint8_t op>
+constexpr Handler cb_handler() {
+    constexpr uint8_t x = op >> 6;
+    constexpr uint8_t y = (op >> 3) & 7;
+    constexpr uint8_t z = op & 7;
+
+    if constexpr (x == 0) return cb_shift<y, z>;
+    else if constexpr (x == 1) return cb_bit<y, z>;
+    else if constexpr (x == 2) return cb_res<y, z>;
+    else return cb_set<y, z>;
+}
+
+// Block cache versions (block_cache.h): PC is already past the instruction and the operand comes decoded
+template <Handler handler>
+void block_plain(CPU& cpu, uint16_t) {
+    handler(cpu);
+}
+
+template <uint8_t op>
+void block_immediate(CPU& cpu, uint16_t operand) {
+    constexpr auto handler = immediate_handler<op>();
+    if constexpr (instruction_length(op) == 2) handler(cpu, (uint8_t)operand);
+    else handler(cpu, operand);
+}
+
+template <uint8_t op>
+constexpr BlockCache::Handler block_handler() {
+    if constexpr (instruction_length(op) > 1) return block_immediate<op>;
+    else return block_plain<base_handler<op>()>;
+}
+
+template <std::size_t... op>
+constexpr std::array<Handler, 256> make_base_table(std::index_sequence<op...>) {
+    return {{ base_handler<(uint8_t)op>()... }};
+}
+
+template <std::size_t... op>
+constexpr std::array<Handler, 256> make_cb_table(std::index_sequence<op...>) {
+    return {{ cb_handler<(uint8_t)op>()... }};
+}
+
+template <std::size_t... op>
+constexpr std::array<BlockCache::Handler, 256> make_block_table(std::index_sequence<op...>) {
+    return {{ block_handler<(uint8_t)op>()... }};
+}
+
+template <std::size_t... op>
+constexpr std::array<BlockCache::Handler, 256> make_cb_block_table(std::index_sequence<op...>) {
+    return {{ block_plain<cb_handler<(uint8_t)op>()>... }};
+}
+
+constexpr std::array<Handler, 256> base_table = make_base_table(std::make_index_sequence<256>{});
+constexpr std::array<Handler, 256> cb_table = make_cb_table(std::make_index_sequence<256>{});
+constexpr std::array<BlockCache::Handler, 256> block_table = make_block_table(std::make_index_sequence<256>{});
+constexpr std::array<BlockCache::Handler, 256> cb_block_table = make_cb_block_table(std::make_index_sequence<256>{});
+
+// T-cycles per opcode, conditional jumps/calls/returns have their not taken count (the handlers add the rest)
+// Illegal opcodes are given 4 so time keeps moving
+constexpr std::array<uint8_t, 256> base_cycles = {
+//  x0  x1  x2  x3  x4  x5  x6  x7  x8  x9  xA  xB  xC  xD  xE  xF
+     4, 12,  8,  8,  4,  4,  8,  4, 20,  8,  8,  8,  4,  4,  8,  4,    // 0x
+     4, 12,  8,  8,  4,  4,  8,  4, 12,  8,  8,  8,  4,  4,  8,  4,    // 1x
+     8, 12,  8,  8,  4,  4,  8,  4,  8,  8,  8,  8,  4,  4,  8,  4,    // 2x
+     8, 12,  8,  8, 12, 12, 12,  4,  8,  8,  8,  8,  4,  4,  8,  4,    // 3x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // 4x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // 5x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // 6x
+     8,  8,  8,  8,  8,  8,  4,  8,  4,  4,  4,  4,  4,  4,  8,  4,    // 7x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // 8x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // 9x
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // Ax
+     4,  4,  4,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,  4,  8,  4,    // Bx
+     8, 12, 12, 16, 12, 16,  8, 16,  8, 16, 12,  4, 12, 24,  8, 16,    // Cx
+     8, 12, 12,  4, 12, 16,  8, 16,  8, 16, 12,  4, 12,  4,  8, 16,    // Dx
+    12, 12,  8,  4,  4, 16,  8, 16, 16,  4, 16,  4,  4,  4,  8, 16,    // Ex
+    12, 12,  8,  4,  4, 16,  8, 16, 12,  8, 16,  4,  4,  4,  8, 16     // Fx
+};
+
+// 0xCB page, on top of the 4 cycles of the prefix itself: 4 for registers, 12 for (HL) (8 for BIT b,(HL))
+constexpr uint8_t cb_cycles(uint8_t op) {
+    if ((op & 7) != 6) return 4;
+    return (op >> 6) == 1 ? 8 : 12;
+}
+
+void op_prefix_cb(CPU& cpu, uint8_t opcode) {
+    cb_table[opcode](cpu);
+    cpu.cycles += cb_cycles(opcode);
+}
+
+} // namespace
+
+size_t BlockCache::decode(const uint8_t* code, size_t available, Instruction& out, bool& ends) {
+    uint8_t opcode = code[0];
+    size_t length = instruction_length(opcode);
+    if (length > available) {
+        return 0;
+    }
+    // The second byte picks the handler straight away, the prefix and its opcode are one instruction with both counts
+    if (opcode == 0xCB) {
+        out = Instruction{cb_block_table[code[1]], 0, 2, (uint8_t)(base_cycles[0xCB] + cb_cycles(code[1]))};
+        ends = false;
+        return length;
+    }
+    uint16_t operand = length == 3 ? (uint16_t)(code[2] << 8 | code[1]) : length == 2 ? code[1] : 0;
+    out = Instruction{block_table[opcode], operand, (uint8_t)length, base_cycles[opcode]};
+    ends = ends_block(opcode);
+    return length;
+}
+
+void CPU::execute(uint8_t opcode) {
+    base_table[opcode](*this);
+    cycles += base_cycles[opcode];
+}
+
+void CPU::step() {
+    uint8_t pending = bus.pending_interrupts();
+    if (pending && service_interrupt(pending)) {
+        return;
+    }
+    if (halted) {
+        cycles += 4;    // HALT keeps the clock running until an interrupt shows up
+        return;
+    }
+    // EI is delayed by one instruction, so the flag only flips once the next one is about to run
+    if (ime_pending) {
+        ime = true;
+        ime_pending = false;
+    }
+    if (trace) {
+        trace->record(*this);
+    }
+    execute(fetch8());
+}
+
+#if defined(MCGB_BLOCK_CACHE)
+
+// Block cache dispatch: the bookkeeping of step() happens once per block, then the decoded instructions run back to
+// back. A block is left early when the deadline comes, an interrupt can be taken, or the code under it changed
+// (a write over it, or a bank switch)
+void CPU::run(uint64_t deadline) {
+    if (trace) {
+        while (cycles < deadline) {
+            step();
+        }
+        return;
+    }
+    while (cycles < deadline) {
+        uint8_t pending = bus.pending_interrupts();
+        if (pending && service_interrupt(pending)) {
+            continue;
+        }
+        if (halted) {
+            skip_halt(deadline);
+            continue;
+        }
+        if (ime_pending) {
+            ime = true;
+            ime_pending = false;
+        }
+        const BlockCache::Instruction* instruction = blocks.find(reg.pc);
+        if (!instruction) {
+            execute(fetch8());  // VRAM, cartridge RAM, or an instruction split across two pages
+            continue;
+        }
+        uint16_t start = reg.pc;
+        bool polling = blocks.page_of(start)->idle_loops.test(start & 0xFF);
+        if (!polling && jit && jit->run(deadline)) {
+            continue;
+        }
+        uint8_t before[sizeof(Registers)];
+        uint64_t start_cycles = cycles;
+        if (polling) {
+            std::memcpy(before, &reg, sizeof(Registers));
+        }
+        uint32_t generation = bus.generation;
+        do {
+            // A write over the page clears its decoded code, `instruction` can't be touched once the handler ran
+            const BlockCache::Instruction current = *instruction;
+            reg.pc += current.length;
+            current.handler(*this, current.operand);
+            cycles += current.cycles;
+            if (bus.generation != generation) {
+                break;
+            }
+            instruction++;
+        } while (instruction->handler && cycles < deadline && !(ime && bus.pending_interrupts()));
+
+        // A polling loop that went around once and came back to the same registers will keep doing exactly that,
+        // what it reads only changes with the next event. Skip every whole lap that ends by the deadline
+        if (polling && bus.generation == generation && !instruction->handler && reg.pc == start && cycles < deadline &&
+            std::memcmp(before, &reg, sizeof(Registers)) == 0) {
+            uint64_t lap = cycles - start_cycles;
+            cycles += (deadline - cycles) / lap * lap;
+        }
+    }
+}
+
+#elif defined(MCGB_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+
+// Threaded dispatch: every opcode gets its own label with the handler inlined into it, and each one ends with its
+// own indirect jump to the next opcode's label. The branch predictor then sees 256 jump sites (one per opcode)
+// instead of the single shared one of the step() loop, so it can learn opcode to opcode patterns
+// Uses labels as values (computed goto), a GCC/Clang extension
+#define MCGB_LABEL(n) &&op_##n,
+#define MCGB_LABEL_ROW(h) \
+    MCGB_LABEL(h##0) MCGB_LABEL(h##1) MCGB_LABEL(h##2) MCGB_LABEL(h##3) \
+    MCGB_LABEL(h##4) MCGB_LABEL(h##5) MCGB_LABEL(h##6) MCGB_LABEL(h##7) \
+    MCGB_LABEL(h##8) MCGB_LABEL(h##9) MCGB_LABEL(h##A) MCGB_LABEL(h##B) \
+    MCGB_LABEL(h##C) MCGB_LABEL(h##D) MCGB_LABEL(h##E) MCGB_LABEL(h##F)
+
+// Same bookkeeping step() does before an instruction, then jump straight to the next handler
+// Interrupts and HALT are rare so they take the slow road back through `slow_path`
+#define MCGB_DISPATCH()                                     \
+    do {                                                    \
+        if (cycles >= deadline) {                           \
+            return;                                         \
+        }                                                   \
+        if (bus.pending_interrupts() || halted) {           \
+            goto slow_path;                                 \
+        }                                                   \
+        if (ime_pending) {                                  \
+            ime = true;                                     \
+            ime_pending = false;                            \
+        }                                                   \
+        goto *labels[fetch8()];                             \
+    } while (0)
+
+#define MCGB_OPCODE(n) op_##n: base_table[0x##n](*this); cycles += base_cycles[0x##n]; MCGB_DISPATCH();
+#define MCGB_OPCODE_ROW(h) \
+    MCGB_OPCODE(h##0) MCGB_OPCODE(h##1) MCGB_OPCODE(h##2) MCGB_OPCODE(h##3) \
+    MCGB_OPCODE(h##4) MCGB_OPCODE(h##5) MCGB_OPCODE(h##6) MCGB_OPCODE(h##7) \
+    MCGB_OPCODE(h##8) MCGB_OPCODE(h##9) MCGB_OPCODE(h##A) MCGB_OPCODE(h##B) \
+    MCGB_OPCODE(h##C) MCGB_OPCODE(h##D) MCGB_OPCODE(h##E) MCGB_OPCODE(h##F)
+
+void CPU::run(uint64_t deadline) {
+    static const void* const labels[256] = {
+        MCGB_LABEL_ROW(0) MCGB_LABEL_ROW(1) MCGB_LABEL_ROW(2) MCGB_LABEL_ROW(3)
+        MCGB_LABEL_ROW(4) MCGB_LABEL_ROW(5) MCGB_LABEL_ROW(6) MCGB_LABEL_ROW(7)
+        MCGB_LABEL_ROW(8) MCGB_LABEL_ROW(9) MCGB_LABEL_ROW(A) MCGB_LABEL_ROW(B)
+        MCGB_LABEL_ROW(C) MCGB_LABEL_ROW(D) MCGB_LABEL_ROW(E) MCGB_LABEL_ROW(F)
+    };
+
+    // Tracing goes through step(), the threaded path stays free of the check
+    if (trace) {
+        while (cycles < deadline) {
+            step();
+        }
+        return;
+    }
+    MCGB_DISPATCH();
+slow_path:
+    step();
+    skip_halt(deadline);
+    MCGB_DISPATCH();
+    MCGB_OPCODE_ROW(0) MCGB_OPCODE_ROW(1) MCGB_OPCODE_ROW(2) MCGB_OPCODE_ROW(3)
+    MCGB_OPCODE_ROW(4) MCGB_OPCODE_ROW(5) MCGB_OPCODE_ROW(6) MCGB_OPCODE_ROW(7)
+    MCGB_OPCODE_ROW(8) MCGB_OPCODE_ROW(9) MCGB_OPCODE_ROW(A) MCGB_OPCODE_ROW(B)
+    MCGB_OPCODE_ROW(C) MCGB_OPCODE_ROW(D) MCGB_OPCODE_ROW(E) MCGB_OPCODE_ROW(F)
+}
+
+#undef MCGB_OPCODE_ROW
+#undef MCGB_OPCODE
+#undef MCGB_DISPATCH
+#undef MCGB_LABEL_ROW
+#undef MCGB_LABEL
+
+#else
+
+// Portable dispatch: one shared indirect call through the base table per instruction
+void CPU::run(uint64_t deadline) {
+    while (cycles < deadline) {
+        step();
+        skip_halt(deadline);
+    }
+}
+
+#endif
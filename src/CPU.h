@@ -5,10 +5,9 @@
 #include <iostream>
 #include <optional>
 
-#include "spdlog/spdlog.h"
-#include "spdlog/sinks/basic_file_sink.h"
-
+#include "block_cache.h"
 #include "bus.h"
+#include "log.h"
 
 #define RESETT       "\033[0m"
 #define RED         "\033[31m"      // For "Error"
@@ -16,1067 +15,427 @@
 #define YELLOW      "\033[33m"      // For Methods (Execute)
 
 
-struct FlagsRegister    //Custom data type for flags register that avoids acidental manipulation of the lower 4 bits
+// Flags register (F), evaluated lazily
+// ALU ops don't compute Z/N/H/C, they only record what they did (operation, operands and result) and the flags are
+// worked out when something actually reads them (conditional jumps, PUSH AF, ADC/SBC carry in...)
+// Most results get overwritten by the next ALU op before anyone looks at their flags so this skips most of the work
+// Only the upper 4 bits exist, the lower 4 always read as 0
+struct FlagsRegister
 {
-    bool zero;          // Bit 7
-    bool subtraction;   // Bit 6
-    bool half_carry;    // Bit 5
-    bool carry;         // Bit 4
+    static constexpr uint8_t ZERO        = 0x80;    // Bit 7
+    static constexpr uint8_t SUBTRACTION = 0x40;    // Bit 6
+    static constexpr uint8_t HALF_CARRY  = 0x20;    // Bit 5
+    static constexpr uint8_t CARRY       = 0x10;    // Bit 4
+
+    enum class Operation : uint8_t {
+        none,   // Flags are all in `known`
+        add,    // 8 bit ADD/ADC (lhs + rhs + carry_in)
+        sub,    // 8 bit SUB/SBC/CP (lhs - rhs - carry_in)
+        inc,    // 8 bit INC, carry comes from `known`
+        dec,    // 8 bit DEC, carry comes from `known`
+        add16   // ADD HL,rr, zero comes from `known`
+    };
+
+    uint8_t known;          // Packed flags, authoritative for everything the pending operation doesn't produce
+    Operation operation;
+    uint8_t carry_in;
+    uint16_t lhs;
+    uint16_t rhs;
+    uint32_t result;        // Full width result so carry/borrow is still in there
+
+    // Recording, used by the ALU helpers
+    void record(Operation op, uint16_t left, uint16_t right, uint8_t carry, uint32_t res) {
+        operation = op;
+        lhs = left;
+        rhs = right;
+        carry_in = carry;
+        result = res;
+    }
+    // Ops that keep some of the old flags (INC/DEC keep carry, ADD HL keeps zero) fold them into `known` first
+    void keep_carry() {
+        known = carry() ? CARRY : 0;
+    }
+    void keep_zero() {
+        known = zero() ? ZERO : 0;
+    }
 
-    uint8_t bool_to_uint(){
-        return  (uint8_t)((uint8_t)zero << 7 | (uint8_t)subtraction << 6 | (uint8_t)half_carry << 5 | (uint8_t)carry << 4); 
+    // Evaluation
+    bool zero() const {
+        switch (operation) {
+            case Operation::none  : return known & ZERO;
+            case Operation::add16 : return known & ZERO;
+            default               : return (uint8_t)result == 0;
+        }
+    }
+    bool subtraction() const {
+        switch (operation) {
+            case Operation::none : return known & SUBTRACTION;
+            case Operation::sub  : return true;
+            case Operation::dec  : return true;
+            default              : return false;
+        }
+    }
+    bool half_carry() const {
+        switch (operation) {
+            case Operation::none  : return known & HALF_CARRY;
+            case Operation::add   : return ((lhs & 0xF) + (rhs & 0xF) + carry_in) > 0xF;
+            case Operation::sub   : return (lhs & 0xF) < (rhs & 0xF) + carry_in;
+            case Operation::inc   : return (lhs & 0xF) == 0xF;
+            case Operation::dec   : return (lhs & 0xF) == 0x0;
+            default               : return ((lhs & 0xFFF) + (rhs & 0xFFF)) > 0xFFF;
+        }
+    }
+    bool carry() const {
+        switch (operation) {
+            case Operation::none  : return known & CARRY;
+            case Operation::add   : return result > 0xFF;
+            case Operation::sub   : return result > 0xFF;    // A borrow wraps the result around
+            case Operation::add16 : return result > 0xFFFF;
+            default               : return known & CARRY;
+        }
     }
 
-    FlagsRegister uint8_t_to_bool(uint8_t u8){
-        FlagsRegister ret;
-        ret.zero = (bool)(u8 >> 7);
-        ret.subtraction = (bool)( (u8 >> 6) & 1 );
-        ret.half_carry = (bool)( (u8 >> 5) & 1 );
-        ret.carry = (bool)( (u8 >> 4) & 1 );
-        return ret;
+    uint8_t to_uint8() const {
+        if (operation == Operation::none) {
+            return known;
+        }
+        return (uint8_t)((zero() ? ZERO : 0) | (subtraction() ? SUBTRACTION : 0) |
+                         (half_carry() ? HALF_CARRY : 0) | (carry() ? CARRY : 0));
+    }
+    void from_uint8(uint8_t value) {
+        known = value & 0xF0;
+        operation = Operation::none;
     }
 };
 
+// 16 bit register pair whose two halves alias the 8 bit registers, so reading or writing a pair is a single 16 bit
+// load/store instead of rebuilding it with shifts. The byte order of the halves follows the host so the high register
+// always lines up with the top byte of the pair (union punning, which GCC/Clang/MSVC all define)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(pair, high, low) union { uint16_t pair; struct { uint8_t high; uint8_t low; }; }
+#else
+#define REGISTER_PAIR(pair, high, low) union { uint16_t pair; struct { uint8_t low; uint8_t high; }; }
+#endif
+
 struct Registers {
-    // "Physical" Registers
-    uint8_t a;
-    uint8_t b;
-    uint8_t c;
-    uint8_t d;
-    uint8_t e;
+    // "Physical" Registers, accessible both as 8 bit halves and as 16 bit pairs
+    REGISTER_PAIR(af, a, f_byte);   // f_byte is only filled in by get_af, the live flags are in `f`
+    REGISTER_PAIR(bc, b, c);
+    REGISTER_PAIR(de, d, e);
+    REGISTER_PAIR(hl, h, l);
+    REGISTER_PAIR(sp, sp_high, sp_low);
+    REGISTER_PAIR(pc, pc_high, pc_low);
     FlagsRegister f;      // Special register for flags
-    uint8_t h;
-    uint8_t l;
 
     // Virtual Registers (“af”, “bc”, “de”, “hl” )
-    
-    /*  //Commented this out cause aparently the f register is a special register used for flags, so 
-        //I believe I cannot alter it therefore rendering the virtual register "af" useless, in any case 
-        //I'd rather have the code here to avoid busywork of copying it and altering var names, should I end up using it
-
-        //Also the f register has suffered custom type alterarion in order to make it error proof so these wont work without refactoring the code
-
     uint16_t get_af() {
-        // Mask register "a" like a+00000000; Left shift "a" 8 times (multiply by 2^8 aka 256)
-        uint16_t A_mask = (uint16_t)a * 256; 
-        return A_mask | f;
+        // Flags are lazy so they get packed into the low byte before the pair is read
+        f_byte = f.to_uint8();
+        return af;
     }
     void set_af(uint16_t value){
-        // Set "a" to the first 8 bits of value and f to the last 8 bits
-        a = (uint8_t)(value / 256);
-        f = (uint8_t)(value & 0x00FF);
-    }
-
-    */
-
-    uint16_t get_bc() {
-        uint16_t B_mask = (uint16_t)b * 256; 
-        return B_mask | c;
-    }
-    void set_bc(uint16_t value){
-        b = (uint8_t)(value / 256);
-        c = (uint8_t)(value & 0x00FF);
+        // The lower nibble of f doesn't exist and always reads as 0
+        af = value & 0xFFF0;
+        f.from_uint8(f_byte);
     }
 
-    uint16_t get_de() {
-        uint16_t D_mask = (uint16_t)d * 256; 
-        return D_mask | e;
-    }
-    void set_de(uint16_t value){
-        d = (uint8_t)(value / 256);
-        e = (uint8_t)(value & 0x00FF);
-    }
+    uint16_t get_bc() { return bc; }
+    void set_bc(uint16_t value) { bc = value; }
 
-    uint16_t get_hl() {
-        uint16_t H_mask = (uint16_t)h * 256; 
-        return H_mask | l;
-    }
-    void set_hl(uint16_t value){
-        h = (uint8_t)(value / 256);
-        l = (uint8_t)(value & 0x00FF);
-    }
-};
+    uint16_t get_de() { return de; }
+    void set_de(uint16_t value) { de = value; }
 
-enum class ArithmeticTarget {
-    a,b,c,d,e,h,l,
-    bc,de,hl,hl_notadress,sp,
-    Null
+    uint16_t get_hl() { return hl; }
+    void set_hl(uint16_t value) { hl = value; }
 };
-enum InstructionType {
-    ADD,    //DONE
-    ADDHL,  //DONE
-    ADC,    //DONE
-    SUB,    //DONE
-    SBC,    //DONE
-    AND,    //DONE
-    OR,     //DONE    
-    XOR,    //DONE
-    CP,     //DONE
-    INC,    //DONE
-    DEC,    //DONE
-    CCF,    //DONE
-    SCF,    //DONE
-    RRA,    //DONE
-    RLA,    //DONE
-    RRCA,   //DONE
-    RRLA,   //DONE
-    CPL,    //DONE
-    BIT,    //DONE
-    RESET,
-    SET,
-    SRL,
-    RR,
-    RL,
-    RRC,
-    RLC,
-    SRA,
-    SLA,
-    SWAP
-};
-struct Instruction {
-    InstructionType Type;
-    ArithmeticTarget Target;
-    std::optional<int8_t> d8; // Only has a value if Target is "NULL" or BIT operations
-
-    // Keep the constructor private to force use of the factory methods
-    private:
-        Instruction(InstructionType t, ArithmeticTarget tg, std::optional<int8_t> imm) 
-            : Type(t), Target(tg), d8(imm) {}
 
-    public:
-        // Factory for register-based instructions (e.g., ADD A, B)
-        static Instruction InstructionWithTargetRegister(InstructionType t, ArithmeticTarget tg) {
-            return Instruction(t, tg, std::nullopt);
-        }
-
-        // Factory for immediate-value instructions (e.g., ADD A, d8)
-        static Instruction InstructionWithImmediate(InstructionType t, int8_t val) {
-            return Instruction(t, ArithmeticTarget::Null, val);
-        }
+#undef REGISTER_PAIR
 
-};
+struct TraceRecorder;
+struct Jit;
 
 //Simulated CPU
 struct CPU {
+    Bus& bus;
     Registers reg;
-    uint16_t PC;
-    uint16_t SP;
 
-    void execute(Instruction instruction) {
-        switch (instruction.Type) {
-            case InstructionType::ADD : {
-                switch (instruction.Target) {
-                    case ArithmeticTarget::a : {
-                        add(reg.a);
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        add(reg.b);
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        add(reg.c);
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        add(reg.d);
-                        break;  
-                    }
-                    case ArithmeticTarget::e : {
-                        add(reg.e);
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        add(reg.h);
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        add(reg.l);
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {  //Add value in 16bit memory adress HL
-                        add(read_memory( (reg.h << 8) & (reg.l) ));
-                        break;
-                    }
-                    default: {
-                        int8_t val;
-                        if (instruction.d8.has_value()) {
-                            val = instruction.d8.value(); // Safe access
-                        } else { throw; }
-                        add(val);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::ADDHL : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::bc : {
-                        addhl(reg.get_bc());
-                        break;
-                    }
-                    case ArithmeticTarget::de : {
-                        addhl(reg.get_de());
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        addhl(reg.get_hl());
-                        break;
-                    }
-                    case ArithmeticTarget::sp : {
-                        addhl(SP);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::ADC : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        adc(reg.a);
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        adc(reg.b);
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        adc(reg.c);
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        adc(reg.d);
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        adc(reg.e);
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        adc(reg.h);
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        adc(reg.l);
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        adc(read_memory(reg.get_hl()));
-                        break;
-                    }
-                    default: {
-                        int8_t val;
-                        if (instruction.d8.has_value()) {
-                            val = instruction.d8.value();
-                        } else { throw; }
-                        adc(val);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::SUB : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        reg.a = (uint8_t)0; // register a minus register a = 0 always
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        sub(reg.b);
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        sub(reg.c);
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        sub(reg.d);
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        sub(reg.e);
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        sub(reg.h);
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        sub(reg.l);
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        sub(read_memory(reg.get_hl()));
-                        break;
-                    }
-                    default: {
-                        int8_t val;
-                        if (instruction.d8.has_value()) {
-                            val = instruction.d8.value();
-                        } else { throw; }
-                        adc(val);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::SBC : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        reg.a = 0;
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        sbc(reg.b);
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        sbc(reg.c);
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        sbc(reg.d);
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        sbc(reg.e);
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        sbc(reg.h);
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        sbc(reg.l);
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        sbc(read_memory(reg.get_hl()));
-                        break;
-                    }
-                    default: {
-                        int8_t val;
-                        if(instruction.d8.has_value()){
-                            val = instruction.d8.value();
-                        } else { throw; }
-                        sbc(val);
-                        break;
-                    }
-                }
-            }
-            case InstructionType::AND : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        break; // a & a = a aka no alterations
-                    }
-                    case ArithmeticTarget::b : {
-                        reg.a = reg.a & reg.b;
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        reg.a = reg.a & reg.c;
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        reg.a = reg.a & reg.d;
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        reg.a = reg.a & reg.e;
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        reg.a = reg.a & reg.h;
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        reg.a = reg.a & reg.l;
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        reg.a = reg.a & read_memory(reg.get_hl());
-                        break;
-                    }
-                    default: {
-                        reg.a = reg.a & instruction.d8.value();
-                        break;
-                    }
-                }
-            }
-            case InstructionType::OR : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        break; // a | a = a aka no alterations
-                    }
-                    case ArithmeticTarget::b : {
-                        reg.a = reg.a | reg.b;
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        reg.a = reg.a | reg.c;
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        reg.a = reg.a | reg.d;
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        reg.a = reg.a | reg.e;
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        reg.a = reg.a | reg.h;
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        reg.a = reg.a | reg.l;
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        reg.a = reg.a | read_memory(reg.get_hl());
-                        break;
-                    }
-                    default: {
-                        reg.a = reg.a | instruction.d8.value();
-                        break;
-                    }
-                }
-            }
-            case InstructionType::XOR : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        reg.a = reg.a ^ reg.a;
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        reg.a = reg.a ^ reg.b;
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        reg.a = reg.a ^ reg.c;
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        reg.a = reg.a ^ reg.d;
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        reg.a = reg.a ^ reg.e;
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        reg.a = reg.a ^ reg.h;
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        reg.a = reg.a ^ reg.l;
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        reg.a = reg.a ^ read_memory(reg.get_hl());
-                        break;
-                    }
-                    default: {
-                        reg.a = reg.a ^ instruction.d8.value();
-                        break;
-                    }
-                }
-            }
-            case InstructionType::CP : {
-                switch (instruction.Target){
-                    case ArithmeticTarget::a : {
-                        compare(reg.a);
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        compare(reg.b);
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        compare(reg.c);
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        compare(reg.d);
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        compare(reg.e);
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        compare(reg.h);
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        compare(reg.l);
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        compare(read_memory(reg.get_hl()));
-                        break;
-                    }
-                    default: {
-                        compare(instruction.d8.value());
-                        break;
-                    }
-                        
-                }
-            }
-            case InstructionType::INC : {
-                switch (instruction.Target) {
-                    case ArithmeticTarget::a : {
-                        reg.a++;
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        reg.b++;
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        reg.c++;
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        reg.d++;
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        reg.e++;
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        reg.h++;
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        reg.l++;
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        uint16_t hl = reg.get_hl();
-                        write_memory(hl, read_memory(hl) + 1);
-                        break;
-                    }
-                    case ArithmeticTarget::bc : {
-                        reg.set_bc(reg.get_bc() + 1);
-                        break;
-                    }
-                    case ArithmeticTarget::de : {
-                        reg.set_de(reg.get_de() + 1);
-                        break;
-                    }
-                    case ArithmeticTarget::sp : {
-                        SP++;
-                        break;
-                    }
-                    case ArithmeticTarget::hl_notadress : {
-                        reg.set_hl(reg.get_hl() + 1);
-                        break;
-                    }
-                    default : {
-                        spdlog::error("Invalid target for INC instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::DEC : {
-                switch (instruction.Target) {
-                    case ArithmeticTarget::a : {
-                        reg.a--;
-                        break;
-                    }
-                    case ArithmeticTarget::b : {
-                        reg.b--;
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        reg.c--;
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        reg.d--;
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        reg.e--;
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        reg.h--;
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        reg.l--;
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        uint16_t hl = reg.get_hl();
-                        write_memory(hl, read_memory(hl) - 1);
-                        break;
-                    }
-                    case ArithmeticTarget::bc : {
-                        reg.set_bc(reg.get_bc() - 1);
-                        break;
-                    }
-                    case ArithmeticTarget::de : {
-                        reg.set_de(reg.get_de() - 1);
-                        break;
-                    }
-                    case ArithmeticTarget::sp : {
-                        SP--;
-                        break;
-                    }
-                    case ArithmeticTarget::hl_notadress : {
-                        reg.set_hl(reg.get_hl() - 1);
-                        break;
-                    }
-                    default : {
-                        spdlog::error("Invalid target for DEC instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                        break;
-                    }
-                }
-                break;
-            }
-            case InstructionType::CCF : {
-                reg.f.carry = !reg.f.carry;
-                break;
-            }
-            case InstructionType::SCF : {
-                reg.f.carry = true;
-                break;
-            }
-            case InstructionType::RRA : {
-                uint8_t bit0 = (reg.a & 0x01);           // Capture bit that will fall off
-                reg.a = (reg.a >> 1) | (reg.f.carry << 7); // Shift and pull in OLD carry
-                reg.f.carry = bit0;
-                break;
-            }
-            case InstructionType::RLA : {
-                uint8_t bit7 = (reg.a >> 7) & 0x01;      // Capture bit that will fall off
-                reg.a = (reg.a << 1) | reg.f.carry;      // Shift and pull in OLD carry
-                reg.f.carry = bit7;
-                break;
-            }
-            case InstructionType::RRCA : {
-                reg.f.carry = (reg.a & 0x01);            // Bit 0 goes to carry
-                reg.a = (reg.a >> 1) | (reg.f.carry << 7);;
-                break;
-            }    
-            case InstructionType::RRLA : {
-                reg.f.carry = (reg.a >> 7) & 0x01;       // Bit 7 goes to carry
-                reg.a = (reg.a << 1) | reg.f.carry;
-                break;
-            }
-            case InstructionType::CPL : {
-                reg.a = ~reg.a;
-                break;
-            }
-            case InstructionType::BIT : {
-                switch (instruction.Target) {
-                    case ArithmeticTarget::a : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.a & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.a & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.a & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.a & 0x08) != 0;
-                                break;
-                            }
-                            case 4 : {
-                                reg.f.zero = (reg.a & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.a & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.a & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.a & 0x80) != 0;
-                                break;
-                            }
-                            default : { 
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
+    bool ime;           // Interrupt master enable
+    bool ime_pending;   // EI only takes effect after the instruction that follows it
+    bool halted;
+
+    uint64_t cycles = 0;    // T-cycles (4.194304 MHz) since power on, never reset. Everything else is timed off this
+    TraceRecorder* trace = nullptr;     // Gets a record before every instruction when set (see trace.h)
+    BlockCache blocks;  // Decoded code, used by run() when built with MCGB_BLOCK_CACHE
+    Jit* jit = nullptr; // Runs hot blocks as native code when set (jit.h), only used by the block cache run()
+
+    explicit CPU(Bus& bus) : bus(bus), blocks(bus) { reset(); }
+
+    // Register state the DMG boot ROM leaves behind when it jumps to the cartridge at 0x0100
+    void reset() {
+        reg.set_af(0x01B0);
+        reg.bc = 0x0013;
+        reg.de = 0x00D8;
+        reg.hl = 0x014D;
+        reg.pc = 0x0100;
+        reg.sp = 0xFFFE;
+        ime = false;
+        ime_pending = false;
+        halted = false;
+        blocks.clear();     // Whatever is mapped now may not be what the blocks were decoded from
+    }
+
+    // Services a pending interrupt or fetches the opcode at PC and runs it through the opcode tables (CPU.cpp)
+    void step();
+    // Dispatches an already fetched opcode through the base table and accounts its cycles
+    void execute(uint8_t opcode);
+    // Runs instructions until `cycles` reaches `deadline` (the scheduler's next event)
+    // Built with MCGB_BLOCK_CACHE it replays cached blocks (block_cache.h) or their JIT translation, with
+    // MCGB_THREADED_DISPATCH it uses the threaded interpreter, otherwise it's a step() loop
+    void run(uint64_t deadline);
+
+    // A halted CPU only wakes up on an interrupt and those are raised by scheduled events, so nothing can happen before
+    // the deadline: the clock jumps there in the 4 cycle steps step() would have taken
+    void skip_halt(uint64_t deadline) {
+        if (halted && cycles < deadline && !bus.pending_interrupts()) {
+            cycles += (deadline - cycles + 3) / 4 * 4;
+        }
+    }
 
-                        }
-                        break;  
-                    }
-                    case ArithmeticTarget::b : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.b & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.b & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.b & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.b & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.b & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.b & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.b & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.b & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::c : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.c & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.c & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.c & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.c & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.c & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.c & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.c & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.c & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::d : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.d & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.d & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.d & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.d & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.d & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.d & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.d & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.d & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::e : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.e & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.e & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.e & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.e & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.e & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.e & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.e & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.e & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::h : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.h & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.h & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.h & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.h & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.h & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.h & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.h & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.h & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::l : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (reg.l & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (reg.l & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (reg.l & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (reg.l & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (reg.l & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (reg.l & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (reg.l & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (reg.l & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                    case ArithmeticTarget::hl : {
-                        switch (instruction.d8.value()) {
-                            case 0 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x01) != 0;
-                                break;
-                            }
-                            case 1 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x02) != 0;
-                                break;
-                            }
-                            case 2 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x04) != 0;
-                                break;
-                            }
-                            case 3 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x08) != 0;
-                                break;
-                            } 
-                            case 4 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x10) != 0;
-                                break;
-                            }
-                            case 5 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x20) != 0;
-                                break;
-                            }
-                            case 6 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x40) != 0;
-                                break;
-                            }
-                            case 7 : {
-                                reg.f.zero = (read_memory(reg.get_hl()) & 0x80) != 0;
-                                break;
-                            }
-                            default : {
-                                spdlog::error("Invalid bit number for BIT instruction. |-> {}, line {}", __FILE_NAME__, __LINE__);
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                }
-            }
-            default: {
-                // No matching instruction
-                // Log using spdlog
-                spdlog::error("Em CPU::execute: Tipo de instrucao desconhecida ou nao implementada: {} |-> {}, line {}", (int)instruction.Type, __FILE_NAME__, __LINE__);
-                break;
-            }
-            }
-        
+    // Wakes the CPU up from HALT and, if IME is set, jumps to the highest priority vector
+    // Returns true if an interrupt was serviced (that takes the place of an instruction)
+    bool service_interrupt(uint8_t pending) {
+        halted = false;
+        if (!ime) {
+            return false;
         }
+        ime = false;
+        uint8_t index = 0;
+        while (!(pending & (1 << index))) {
+            index++;
+        }
+        bus.high[0x0F] &= ~(1 << index);
+        push16(reg.pc);
+        reg.pc = 0x0040 + index * 8;
+        cycles += 20;
+        return true;
+    }
+
+    // Bus helpers
+    uint8_t read8(uint16_t address) {
+        return bus.read_memory(address);
+    }
+    void write8(uint16_t address, uint8_t value) {
+        bus.write_memory(value, address);
+    }
+    uint8_t fetch8() {
+        return read8(reg.pc++);
+    }
+    uint16_t fetch16() {
+        uint8_t lo = fetch8();
+        uint8_t hi = fetch8();
+        return (uint16_t)(hi << 8 | lo);
+    }
+    void push16(uint16_t value) {
+        write8(--reg.sp, (uint8_t)(value >> 8));
+        write8(--reg.sp, (uint8_t)(value & 0x00FF));
+    }
+    uint16_t pop16() {
+        uint8_t lo = read8(reg.sp++);
+        uint8_t hi = read8(reg.sp++);
+        return (uint16_t)(hi << 8 | lo);
+    }
+
+    // Operand access, the index is the 3 bit field used by the opcodes: B C D E H L (HL) A
+    // They are templates so every handler gets its operand resolved at compile time
+    template <uint8_t index>
+    uint8_t get_r8() {
+        static_assert(index < 8, "8 bit register index out of range");
+        if constexpr (index == 0) return reg.b;
+        else if constexpr (index == 1) return reg.c;
+        else if constexpr (index == 2) return reg.d;
+        else if constexpr (index == 3) return reg.e;
+        else if constexpr (index == 4) return reg.h;
+        else if constexpr (index == 5) return reg.l;
+        else if constexpr (index == 6) return read8(reg.get_hl());
+        else return reg.a;
+    }
+    template <uint8_t index>
+    void set_r8(uint8_t value) {
+        static_assert(index < 8, "8 bit register index out of range");
+        if constexpr (index == 0) reg.b = value;
+        else if constexpr (index == 1) reg.c = value;
+        else if constexpr (index == 2) reg.d = value;
+        else if constexpr (index == 3) reg.e = value;
+        else if constexpr (index == 4) reg.h = value;
+        else if constexpr (index == 5) reg.l = value;
+        else if constexpr (index == 6) write8(reg.get_hl(), value);
+        else reg.a = value;
+    }
+    // 16 bit pair index: BC DE HL SP
+    template <uint8_t index>
+    uint16_t get_rp() {
+        static_assert(index < 4, "16 bit register index out of range");
+        if constexpr (index == 0) return reg.get_bc();
+        else if constexpr (index == 1) return reg.get_de();
+        else if constexpr (index == 2) return reg.get_hl();
+        else return reg.sp;
+    }
+    template <uint8_t index>
+    void set_rp(uint16_t value) {
+        static_assert(index < 4, "16 bit register index out of range");
+        if constexpr (index == 0) reg.set_bc(value);
+        else if constexpr (index == 1) reg.set_de(value);
+        else if constexpr (index == 2) reg.set_hl(value);
+        else reg.sp = value;
+    }
+    // Branch condition index: NZ Z NC C
+    template <uint8_t index>
+    bool condition() {
+        static_assert(index < 4, "condition index out of range");
+        if constexpr (index == 0) return !reg.f.zero();
+        else if constexpr (index == 1) return reg.f.zero();
+        else if constexpr (index == 2) return !reg.f.carry();
+        else return reg.f.carry();
+    }
 
+    // ALU helpers, all of them operate on register a
+    // The arithmetic ones only record their operands in reg.f, flags get evaluated when they are read
     void add(uint8_t value) {
         uint8_t a = reg.a;
         uint16_t result = (uint16_t)a + (uint16_t)value;
-        uint8_t new_value = (uint8_t)result;
-
-        // Set Flags
-        reg.f.zero = (new_value == 0);
-        reg.f.subtraction = false;
-        // Half-carry: check if there's a carry from bit 3 to bit 4
-        reg.f.half_carry = ((a & 0xF) + (value & 0xF)) > 0xF;
-        reg.f.carry = result > 0xFF;
-
-        reg.a = new_value;    
+        reg.f.record(FlagsRegister::Operation::add, a, value, 0, result);
+        reg.a = (uint8_t)result;    
     }
     void addhl(uint16_t value) {
         uint16_t hl = reg.get_hl();
         uint32_t result = (uint32_t)hl + (uint32_t)value;
-
-        // Set Flags
-        reg.f.zero = (result == 0);
-        reg.f.subtraction = false;
-        // Half-carry: check if there's a carry from bit 3 to bit 4
-        reg.f.half_carry = ((hl & 0xF) + (value & 0xF)) > 0xF;
-        reg.f.carry = result > 0xFFFF;
-
+        reg.f.keep_zero();      // zero is left untouched by ADD HL,rr
+        reg.f.record(FlagsRegister::Operation::add16, hl, value, 0, result);
         reg.set_hl((uint16_t)result);
     }
     void adc(uint8_t value){
         uint8_t a = reg.a;
-        uint8_t carry = reg.f.carry ? 1:0;
-        uint16_t result = (uint16_t)a + (uint16_t)value + (uint16_t)1;
-
+        uint8_t carry = reg.f.carry() ? 1:0;
+        uint16_t result = (uint16_t)a + (uint16_t)value + (uint16_t)carry;
+        reg.f.record(FlagsRegister::Operation::add, a, value, carry, result);
         reg.a = (uint8_t)result;
-
-        //Flags
-        reg.f.zero = (reg.a == 0);
-        reg.f.subtraction = false;
-        reg.f.carry = result > 0xFF;
-        reg.f.half_carry = ( (a & 0xF) + (value & 0xF) + 1 ) > 0xF;
     }
     void sub(uint8_t value){
-        reg.a = reg.a - value;
-        reg.f.zero = (reg.a == 0);
-        reg.f.subtraction = true;
+        uint8_t a = reg.a;
+        uint16_t result = (uint16_t)(a - value);
+        reg.f.record(FlagsRegister::Operation::sub, a, value, 0, result);
+        reg.a = (uint8_t)result;
     }
     void sbc(uint8_t value){
-        reg.a = reg.a - value - (bool)reg.f.carry;
-        reg.f.zero = (reg.a == 0);
-        reg.f.subtraction = true;
+        uint8_t a = reg.a;
+        uint8_t carry = reg.f.carry() ? 1:0;
+        uint16_t result = (uint16_t)(a - value - carry);
+        reg.f.record(FlagsRegister::Operation::sub, a, value, carry, result);
+        reg.a = (uint8_t)result;
     }
     void compare(uint8_t value){
-        uint8_t a = reg.a;
-        sub(value);
-        if (reg.a = 0x0) {
-            reg.f.zero = true;
-        } else {
-            reg.f.zero = false;
+        // Same as sub but the result is thrown away
+        reg.f.record(FlagsRegister::Operation::sub, reg.a, value, 0, (uint16_t)(reg.a - value));
+    }
+    // The logic ops have fixed N/H/C so they just store the packed byte
+    void bitwise_and(uint8_t value) {
+        reg.a = reg.a & value;
+        reg.f.from_uint8((reg.a == 0 ? FlagsRegister::ZERO : 0) | FlagsRegister::HALF_CARRY);
+    }
+    void bitwise_or(uint8_t value) {
+        reg.a = reg.a | value;
+        reg.f.from_uint8(reg.a == 0 ? FlagsRegister::ZERO : 0);
+    }
+    void bitwise_xor(uint8_t value) {
+        reg.a = reg.a ^ value;
+        reg.f.from_uint8(reg.a == 0 ? FlagsRegister::ZERO : 0);
+    }
+    // INC/DEC on 8 bit operands leave carry alone
+    uint8_t inc(uint8_t value) {
+        uint8_t result = value + 1;
+        reg.f.keep_carry();
+        reg.f.record(FlagsRegister::Operation::inc, value, 1, 0, result);
+        return result;
+    }
+    uint8_t dec(uint8_t value) {
+        uint8_t result = value - 1;
+        reg.f.keep_carry();
+        reg.f.record(FlagsRegister::Operation::dec, value, 1, 0, result);
+        return result;
+    }
+    // SP + signed 8 bit offset, shared by ADD SP,e8 and LD HL,SP+e8. Flags come from the low byte add, zero is cleared
+    uint16_t add_sp(int8_t offset) {
+        uint16_t value = (uint16_t)(int16_t)offset;
+        bool half_carry = ((reg.sp & 0xF) + (value & 0xF)) > 0xF;
+        bool carry = ((reg.sp & 0xFF) + (value & 0xFF)) > 0xFF;
+        reg.f.from_uint8((half_carry ? FlagsRegister::HALF_CARRY : 0) | (carry ? FlagsRegister::CARRY : 0));
+        return (uint16_t)(reg.sp + value);
+    }
+    void daa() {
+        uint8_t correction = 0;
+        bool subtraction = reg.f.subtraction();
+        bool carry = reg.f.carry();
+        if (reg.f.half_carry() || (!subtraction && (reg.a & 0xF) > 0x9)) {
+            correction |= 0x06;
         }
-        reg.f.subtraction = true;
-        reg.a = a;
+        if (carry || (!subtraction && reg.a > 0x99)) {
+            correction |= 0x60;
+            carry = true;
+        }
+        reg.a = subtraction ? reg.a - correction : reg.a + correction;
+        reg.f.from_uint8((reg.a == 0 ? FlagsRegister::ZERO : 0) | (subtraction ? FlagsRegister::SUBTRACTION : 0) |
+                         (carry ? FlagsRegister::CARRY : 0));
+    }
+
+    // Rotates/shifts of the 0xCB page, they return the new value and set all four flags
+    uint8_t rlc(uint8_t value) {
+        uint8_t result = (uint8_t)(value << 1 | value >> 7);
+        set_shift_flags(result, value >> 7);
+        return result;
+    }
+    uint8_t rrc(uint8_t value) {
+        uint8_t result = (uint8_t)(value >> 1 | value << 7);
+        set_shift_flags(result, value & 0x01);
+        return result;
+    }
+    uint8_t rl(uint8_t value) {
+        uint8_t result = (uint8_t)(value << 1 | (reg.f.carry() ? 1:0));   // Shift and pull in OLD carry
+        set_shift_flags(result, value >> 7);
+        return result;
+    }
+    uint8_t rr(uint8_t value) {
+        uint8_t result = (uint8_t)(value >> 1 | (reg.f.carry() ? 0x80:0));
+        set_shift_flags(result, value & 0x01);
+        return result;
+    }
+    uint8_t sla(uint8_t value) {
+        uint8_t result = (uint8_t)(value << 1);
+        set_shift_flags(result, value >> 7);
+        return result;
+    }
+    uint8_t sra(uint8_t value) {
+        uint8_t result = (uint8_t)((value >> 1) | (value & 0x80));    // Bit 7 is kept (arithmetic shift)
+        set_shift_flags(result, value & 0x01);
+        return result;
+    }
+    uint8_t swap(uint8_t value) {
+        uint8_t result = (uint8_t)(value << 4 | value >> 4);
+        set_shift_flags(result, 0);
+        return result;
+    }
+    uint8_t srl(uint8_t value) {
+        uint8_t result = (uint8_t)(value >> 1);
+        set_shift_flags(result, value & 0x01);
+        return result;
+    }
+    void set_shift_flags(uint8_t result, uint8_t carry) {
+        reg.f.from_uint8((result == 0 ? FlagsRegister::ZERO : 0) | (carry ? FlagsRegister::CARRY : 0));
+    }
+    void bit(uint8_t bit_index, uint8_t value) {
+        // Zero is set when the tested bit is 0, carry is kept
+        bool zero = (value & (1 << bit_index)) == 0;
+        reg.f.from_uint8((zero ? FlagsRegister::ZERO : 0) | FlagsRegister::HALF_CARRY | (reg.f.carry() ? FlagsRegister::CARRY : 0));
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,421 @@
+#include "apu.h"
+
+#include <algorithm>
+#include <initializer_list>
+#include <iterator>
+
+namespace {
+
+// Bits that read back as 1 for 0xFF10-0xFF2F (write only and unused bits), NR52 is built separately
+constexpr uint8_t READ_MASKS[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,   // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,   // (NR20) NR21-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,   // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,   // (NR40) NR41-NR44
+    0x00, 0x00, 0x70,               // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Square duty cycles, one bit per step: 12.5%, 25%, 50%, 75%
+constexpr uint8_t DUTY_PATTERNS[4] = {0x01, 0x81, 0x87, 0x7E};
+
+// NR32 output level: mute, 100%, 50%, 25%
+constexpr uint8_t WAVE_SHIFTS[4] = {4, 0, 1, 2};
+
+constexpr uint16_t LENGTH_MAX[4] = {64, 64, 256, 64};
+
+uint8_t apu_read(void* context, uint16_t address) {
+    return static_cast<APU*>(context)->read(address);
+}
+
+void apu_write(void* context, uint16_t address, uint8_t value) {
+    static_cast<APU*>(context)->write(address, value);
+}
+
+void apu_frame_sequencer(void* context, uint64_t time) {
+    static_cast<APU*>(context)->frame_sequencer(time);
+}
+
+} // namespace
+
+APU::APU(Bus& bus, Scheduler& scheduler)
+    : bus(bus), scheduler(scheduler), left(SAMPLE_RATE / 10), right(SAMPLE_RATE / 10) {
+    for (uint16_t address = 0xFF10; address <= 0xFF2F; address++) {
+        bus.map_io(address, this, apu_read, apu_write);
+    }
+    // Wave RAM reads are plain memory, writes catch the wave channel up first
+    for (uint16_t address = 0xFF30; address <= 0xFF3F; address++) {
+        bus.map_io(address, this, nullptr, apu_write);
+    }
+    scheduler.set_callback(Event::apu_frame_sequencer, this, apu_frame_sequencer);
+    set_sample_rate(SAMPLE_RATE);
+
+    // Values the boot ROM leaves behind, the start up chime has faded out on channel 1 but it is still on
+    static constexpr uint8_t BOOT_VALUES[0x17] = {
+        0x80, 0xBF, 0xF3, 0x00, 0xBF, 0x00, 0x3F, 0x00, 0x00, 0xBF, 0x7F, 0xFF,
+        0x9F, 0x00, 0xBF, 0x00, 0xFF, 0x00, 0x00, 0xBF, 0x77, 0xF3, 0x80,
+    };
+    std::copy(std::begin(BOOT_VALUES), std::end(BOOT_VALUES), &bus.high[NR10]);
+    channels[0].enabled = true;
+    channels[0].dac = true;
+    for (int i = 0; i < 4; i++) {
+        update_period(i);
+        channels[i].next_step = scheduler.now() + channels[i].period;
+    }
+    frame_start = scheduler.now();
+    scheduler.schedule(Event::apu_frame_sequencer, scheduler.now() + SEQUENCER_PERIOD);
+}
+
+void APU::set_sample_rate(double rate) {
+    left.set_rates(CLOCK_RATE, rate);
+    right.set_rates(CLOCK_RATE, rate);
+}
+
+void APU::end_frame(uint64_t now) {
+    run_channels(now);
+    if (output_enabled) {
+        left.end_frame((uint32_t)(now - frame_start));
+        right.end_frame((uint32_t)(now - frame_start));
+    }
+    frame_start = now;
+}
+
+void APU::refresh_output(uint64_t now) {
+    for (int i = 0; i < 4; i++) {
+        update_amplitude(i, now);
+    }
+}
+
+size_t APU::read_samples(int16_t* out, size_t count) {
+    count = left.read_samples(out, count, 2);
+    right.read_samples(out + 1, count, 2);
+    return count;
+}
+
+uint8_t APU::read(uint16_t address) {
+    uint8_t offset = address & 0xFF;
+    if (offset == NR52) {
+        uint8_t status = powered ? 0xF0 : 0x70;
+        for (int i = 0; i < 4; i++) {
+            status |= channels[i].enabled ? 1 << i : 0;
+        }
+        return status;
+    }
+    return bus.high[offset] | READ_MASKS[offset - NR10];
+}
+
+void APU::write(uint16_t address, uint8_t value) {
+    uint8_t offset = address & 0xFF;
+    uint64_t now = scheduler.now();
+    if (offset >= WAVE_RAM) {
+        run_channel(2, now);
+        bus.high[offset] = value;
+        return;
+    }
+    if (offset == NR52) {
+        if (!(value & 0x80) && powered) {
+            power_off(now);
+        } else if ((value & 0x80) && !powered) {
+            powered = true;
+            sequencer_step = 0;
+        }
+        return;
+    }
+    // Powered off, every register but NR52 (and wave RAM) is read only
+    if (!powered || offset > NR52) {
+        return;
+    }
+
+    run_channels(now);
+    if (offset == NR50 || offset == NR51) {
+        // The levels already on the buffers were added with the old gains, take them out and put them back
+        for (int i = 0; i < 4; i++) {
+            set_amplitude(i, 0, now);
+        }
+        bus.high[offset] = value;
+        for (int i = 0; i < 4; i++) {
+            update_amplitude(i, now);
+        }
+        return;
+    }
+    bus.high[offset] = value;
+
+    int index = (offset - NR10) / 5;
+    Channel& channel = channels[index];
+    switch ((offset - NR10) % 5) {
+        case 0 : {
+            // NR30 is the wave DAC, NR10 (sweep) is read when it's used
+            if (index == 2) {
+                channel.dac = value & 0x80;
+                channel.enabled &= channel.dac;
+            }
+            break;
+        }
+        case 1 : {
+            channel.length = index == 2 ? 256 - value : 64 - (value & 0x3F);
+            break;
+        }
+        case 2 : {
+            // Envelope, the DAC is off when both the starting volume and the direction are 0
+            if (index != 2) {
+                channel.dac = value & 0xF8;
+                channel.enabled &= channel.dac;
+            }
+            break;
+        }
+        case 3 : {
+            if (index != 3) {
+                channel.frequency = (channel.frequency & 0x700) | value;
+            }
+            update_period(index);
+            break;
+        }
+        case 4 : {
+            if (index != 3) {
+                channel.frequency = (channel.frequency & 0xFF) | ((value & 0x07) << 8);
+                update_period(index);
+            }
+            channel.length_enabled = value & 0x40;
+            if (value & 0x80) {
+                trigger(index, now);
+            }
+            break;
+        }
+    }
+    update_amplitude(index, now);
+}
+
+void APU::frame_sequencer(uint64_t time) {
+    scheduler.schedule(Event::apu_frame_sequencer, time + SEQUENCER_PERIOD);
+    if (!powered) {
+        return;
+    }
+    uint64_t now = scheduler.now();
+    run_channels(now);
+
+    // 512 Hz, 8 steps: length counters at 256 Hz, sweep at 128 Hz, envelopes at 64 Hz
+    uint8_t step = sequencer_step;
+    sequencer_step = (sequencer_step + 1) & 7;
+    if ((step & 1) == 0) {
+        for (Channel& channel : channels) {
+            if (channel.length_enabled && channel.length > 0 && --channel.length == 0) {
+                channel.enabled = false;
+            }
+        }
+    }
+    if (step == 2 || step == 6) {
+        uint8_t nr10 = bus.high[NR10];
+        uint8_t period = (nr10 >> 4) & 0x07;
+        if (sweep_timer > 0 && --sweep_timer == 0) {
+            sweep_timer = period ? period : 8;
+            if (sweep_enabled && period) {
+                uint16_t frequency = sweep_calculate();
+                if (frequency <= 2047 && (nr10 & 0x07)) {
+                    sweep_shadow = frequency;
+                    channels[0].frequency = frequency;
+                    bus.high[0x13] = frequency & 0xFF;
+                    bus.high[0x14] = (bus.high[0x14] & 0xF8) | (frequency >> 8);
+                    update_period(0);
+                    sweep_calculate();  // Overflow check with the new value
+                }
+            }
+        }
+    }
+    if (step == 7) {
+        for (int i : {0, 1, 3}) {
+            Channel& channel = channels[i];
+            uint8_t envelope = bus.high[NR10 + i * 5 + 2];
+            uint8_t period = envelope & 0x07;
+            if (period == 0 || channel.envelope_timer == 0 || --channel.envelope_timer > 0) {
+                continue;
+            }
+            channel.envelope_timer = period;
+            if ((envelope & 0x08) && channel.volume < 15) {
+                channel.volume++;
+            } else if (!(envelope & 0x08) && channel.volume > 0) {
+                channel.volume--;
+            }
+        }
+    }
+
+    for (int i = 0; i < 4; i++) {
+        update_amplitude(i, now);
+    }
+}
+
+void APU::run_channels(uint64_t until) {
+    for (int i = 0; i < 4; i++) {
+        run_channel(i, until);
+    }
+}
+
+// Steps a channel's timer up to `until`, only level changes reach the blip buffers
+void APU::run_channel(int index, uint64_t until) {
+    Channel& channel = channels[index];
+    if (!output_enabled || !channel.enabled || channel.period == 0) {
+        // Nobody listens (or nothing to hear), the waveform position is not worth keeping exact
+        channel.next_step = std::max(channel.next_step, until);
+        return;
+    }
+    while (channel.next_step < until) {
+        step_channel(index);
+        update_amplitude(index, channel.next_step);
+        channel.next_step += channel.period;
+    }
+}
+
+void APU::step_channel(int index) {
+    Channel& channel = channels[index];
+    switch (index) {
+        case 0 :
+        case 1 : {
+            channel.position = (channel.position + 1) & 7;
+            break;
+        }
+        case 2 : {
+            channel.position = (channel.position + 1) & 31;
+            break;
+        }
+        case 3 : {
+            uint16_t bit = (lfsr ^ (lfsr >> 1)) & 1;
+            lfsr = (uint16_t)((lfsr >> 1) | (bit << 14));
+            if (bus.high[0x22] & 0x08) {
+                lfsr = (uint16_t)((lfsr & ~0x40) | (bit << 6));     // 7 bit mode
+            }
+            break;
+        }
+    }
+}
+
+// Digital output of a channel, 0-15
+int APU::channel_output(int index) const {
+    const Channel& channel = channels[index];
+    if (!channel.enabled || !channel.dac) {
+        return 0;
+    }
+    switch (index) {
+        case 0 :
+        case 1 : {
+            uint8_t duty = bus.high[NR10 + index * 5 + 1] >> 6;
+            return (DUTY_PATTERNS[duty] >> channel.position) & 1 ? channel.volume : 0;
+        }
+        case 2 : {
+            uint8_t sample = bus.high[WAVE_RAM + channel.position / 2];
+            sample = channel.position & 1 ? sample & 0x0F : sample >> 4;
+            return sample >> WAVE_SHIFTS[(bus.high[0x1C] >> 5) & 0x03];
+        }
+        default : {
+            return (lfsr & 1) ? 0 : channel.volume;
+        }
+    }
+}
+
+void APU::update_amplitude(int index, uint64_t time) {
+    set_amplitude(index, channel_output(index), time);
+}
+
+// `amplitude` always matches what the buffers hold, so nothing changes while the output is disabled
+void APU::set_amplitude(int index, int amplitude, uint64_t time) {
+    Channel& channel = channels[index];
+    int delta = amplitude - channel.amplitude;
+    if (delta == 0 || !output_enabled) {
+        return;
+    }
+    channel.amplitude = amplitude;
+    uint32_t offset = (uint32_t)(std::max(time, frame_start) - frame_start);
+    int gain = gain_left(index);
+    if (gain) {
+        left.add_delta(offset, delta * gain);
+    }
+    gain = gain_right(index);
+    if (gain) {
+        right.add_delta(offset, delta * gain);
+    }
+}
+
+// NR51 routes each channel to the left (high nibble) and right (low nibble) terminals, NR50 sets their volume (0-7)
+int APU::gain_left(int index) const {
+    return (bus.high[NR51] >> (index + 4)) & 1 ? (((bus.high[NR50] >> 4) & 0x07) + 1) * OUTPUT_SCALE : 0;
+}
+
+int APU::gain_right(int index) const {
+    return (bus.high[NR51] >> index) & 1 ? ((bus.high[NR50] & 0x07) + 1) * OUTPUT_SCALE : 0;
+}
+
+void APU::trigger(int index, uint64_t now) {
+    Channel& channel = channels[index];
+    channel.enabled = channel.dac;
+    if (channel.length == 0) {
+        channel.length = LENGTH_MAX[index];
+    }
+    channel.next_step = now + channel.period;
+    if (index != 2) {
+        uint8_t envelope = bus.high[NR10 + index * 5 + 2];
+        channel.volume = envelope >> 4;
+        channel.envelope_timer = envelope & 0x07;
+    }
+    if (index == 0) {
+        uint8_t nr10 = bus.high[NR10];
+        uint8_t period = (nr10 >> 4) & 0x07;
+        sweep_shadow = channel.frequency;
+        sweep_timer = period ? period : 8;
+        sweep_enabled = period || (nr10 & 0x07);
+        if (nr10 & 0x07) {
+            sweep_calculate();
+        }
+    } else if (index == 2) {
+        channel.position = 0;
+    } else if (index == 3) {
+        lfsr = 0x7FFF;
+    }
+}
+
+void APU::update_period(int index) {
+    Channel& channel = channels[index];
+    switch (index) {
+        case 0 :
+        case 1 : channel.period = (2048 - channel.frequency) * 4; break;
+        case 2 : channel.period = (2048 - channel.frequency) * 2; break;
+        default : {
+            uint8_t nr43 = bus.high[0x22];
+            uint32_t divisor = (nr43 & 0x07) ? (nr43 & 0x07) * 16 : 8;
+            channel.period = divisor << (nr43 >> 4);
+            break;
+        }
+    }
+}
+
+// Next sweep frequency, past 2047 the channel is turned off
+uint16_t APU::sweep_calculate() {
+    uint8_t nr10 = bus.high[NR10];
+    uint16_t change = sweep_shadow >> (nr10 & 0x07);
+    uint16_t frequency = (nr10 & 0x08) ? sweep_shadow - change : sweep_shadow + change;
+    if (frequency > 2047) {
+        channels[0].enabled = false;
+    }
+    return frequency;
+}
+
+void APU::power_off(uint64_t now) {
+    run_channels(now);
+    // Silence the channels while NR50/NR51 still hold the gains their levels were added with
+    for (int i = 0; i < 4; i++) {
+        set_amplitude(i, 0, now);
+    }
+    // The length counters survive on the DMG
+    for (Channel& channel : channels) {
+        Channel cleared;
+        cleared.length = channel.length;
+        cleared.amplitude = channel.amplitude;
+        cleared.next_step = now;
+        channel = cleared;
+    }
+    for (uint8_t offset = NR10; offset < NR52; offset++) {
+        bus.high[offset] = 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        update_period(i);
+    }
+    sweep_enabled = false;
+    powered = false;
+}
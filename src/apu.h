@@ -0,0 +1,101 @@
+// Header file for the APU component
+// The four DMG sound channels (two squares, wave, noise), registers 0xFF10-0xFF26 and wave RAM 0xFF30-0xFF3F
+// Nothing is ticked per cycle: the frame sequencer (length, sweep, envelope at 512 Hz) is a scheduler event and the
+// channels are caught up lazily, on register writes and at the end of each frame. While catching up, a channel only
+// does work at its own timer steps and only reports the ones that change its level, as band-limited steps into the
+// left/right BlipBuffers at the output rate
+// With output disabled (headless, fast-forward) the registers and the frame sequencer keep working but no waveform
+// is stepped at all
+#ifndef APU_H
+#define APU_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "blip_buffer.h"
+#include "bus.h"
+#include "scheduler.h"
+
+struct APU {
+    static constexpr int SAMPLE_RATE = 48000;
+    static constexpr double CLOCK_RATE = 4194304.0;
+    static constexpr uint32_t SEQUENCER_PERIOD = 8192;     // 512 Hz
+    static constexpr int OUTPUT_SCALE = 32;                // Per channel, per volume step (15 * 4 * 8 * 32 fits int16)
+
+    // Register offsets in bus.high
+    static constexpr uint8_t NR10 = 0x10;
+    static constexpr uint8_t NR30 = 0x1A;
+    static constexpr uint8_t NR50 = 0x24;
+    static constexpr uint8_t NR51 = 0x25;
+    static constexpr uint8_t NR52 = 0x26;
+    static constexpr uint8_t WAVE_RAM = 0x30;
+
+    struct Channel {
+        bool enabled = false;       // NR52 status bit
+        bool dac = false;
+        bool length_enabled = false;
+        uint16_t length = 0;        // Counts down to 0, then the channel turns off
+        uint16_t frequency = 0;     // 11 bit period value of NRx3/NRx4
+        uint8_t volume = 0;         // Envelope output (squares and noise)
+        uint8_t envelope_timer = 0;
+        uint8_t position = 0;       // Duty step (squares) or wave sample (wave)
+        uint32_t period = 0;        // Cycles between timer steps
+        uint64_t next_step = 0;     // Cycle of the next timer step
+        int amplitude = 0;          // Level currently on the blip buffers, -15..15 (0 when off)
+    };
+
+    Bus& bus;
+    Scheduler& scheduler;
+
+    std::array<Channel, 4> channels;
+    bool powered = true;
+    uint8_t sequencer_step = 0;
+    // Square 1 sweep
+    bool sweep_enabled = false;
+    uint8_t sweep_timer = 0;
+    uint16_t sweep_shadow = 0;
+    // Noise
+    uint16_t lfsr = 0x7FFF;
+
+    // Output
+    bool output_enabled = false;
+    uint64_t frame_start = 0;   // Cycle the current blip frame started at
+    BlipBuffer left;
+    BlipBuffer right;
+
+    APU(Bus& bus, Scheduler& scheduler);
+    APU(const APU&) = delete;
+    APU& operator=(const APU&) = delete;
+
+    // Output rate, can be nudged around SAMPLE_RATE for dynamic rate control
+    void set_sample_rate(double rate);
+    // Catches the channels up to `now` and makes the samples up to there readable
+    void end_frame(uint64_t now);
+    size_t samples_available() const { return left.available; }
+    // Puts every channel's current level on the buffers, after its state was changed from outside (save states)
+    void refresh_output(uint64_t now);
+    // Interleaved stereo, `out` holds 2 * `count` samples. Returns the number of stereo frames read
+    size_t read_samples(int16_t* out, size_t count);
+
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t value);
+    void frame_sequencer(uint64_t time);
+
+private:
+    void run_channels(uint64_t until);
+    void run_channel(int index, uint64_t until);
+    void step_channel(int index);
+    int channel_output(int index) const;
+    void update_amplitude(int index, uint64_t time);
+    void set_amplitude(int index, int amplitude, uint64_t time);
+    int gain_left(int index) const;
+    int gain_right(int index) const;
+
+    void trigger(int index, uint64_t now);
+    void update_period(int index);
+    uint16_t sweep_calculate();
+    void power_off(uint64_t now);
+};
+
+#endif
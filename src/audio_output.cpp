@@ -0,0 +1,46 @@
+#include "audio_output.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+
+#include "apu.h"
+
+namespace {
+
+// SDL audio thread: `additional` bytes are needed right now, whatever isn't in the ring yet is played as silence
+void SDLCALL audio_callback(void* context, SDL_AudioStream* stream, int additional, int) {
+    AudioOutput& output = *static_cast<AudioOutput*>(context);
+    int16_t samples[1024];
+    size_t needed = (size_t)additional / sizeof(int16_t);
+    while (needed > 0) {
+        size_t count = std::min(needed, sizeof(samples) / sizeof(samples[0]));
+        size_t read = output.ring.pop(samples, count);
+        if (read < count) {
+            std::fill(samples + read, samples + count, 0);
+        }
+        SDL_PutAudioStreamData(stream, samples, (int)(count * sizeof(int16_t)));
+        needed -= count;
+    }
+}
+
+} // namespace
+
+AudioOutput::~AudioOutput() {
+    if (stream) {
+        SDL_DestroyAudioStream(stream);
+    }
+}
+
+bool AudioOutput::open() {
+    SDL_AudioSpec spec{SDL_AUDIO_S16, 2, APU::SAMPLE_RATE};
+    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, audio_callback, this);
+    if (!stream) {
+        spdlog::error("Falha ao abrir o dispositivo de audio: {}", SDL_GetError());
+        return false;
+    }
+    SDL_ResumeAudioStreamDevice(stream);
+    spdlog::info("Audio iniciado: {} Hz, estereo", APU::SAMPLE_RATE);
+    return true;
+}
@@ -0,0 +1,25 @@
+// Header file for the AudioOutput (SDL frontend)
+// Plays the APU samples through an SDL audio stream on the default device. SDL calls back from its own audio
+// thread whenever it needs more data and the callback takes it from the ring, padding with silence on an underrun
+// Keeping the ring near its target fill is the emulation thread's job (see EmulationThread::queue_audio)
+#ifndef AUDIO_OUTPUT_H
+#define AUDIO_OUTPUT_H
+
+#include <SDL3/SDL.h>
+
+#include "audio_ring.h"
+
+struct AudioOutput {
+    AudioRing ring;
+    SDL_AudioStream* stream = nullptr;
+
+    AudioOutput() = default;
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
+    ~AudioOutput();
+
+    // Opens the default playback device at APU::SAMPLE_RATE, stereo 16 bit. Returns false (and logs why) on failure
+    bool open();
+};
+
+#endif
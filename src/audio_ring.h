@@ -0,0 +1,13 @@
+// Header file for the AudioRing
+// Interleaved stereo samples from the emulation thread (producer) to the SDL audio callback (consumer)
+// 16384 samples = 8192 stereo frames, ~170ms at 48 kHz, far more than the ~2 frames of latency it is kept at
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <cstdint>
+
+#include "spsc_queue.h"
+
+using AudioRing = SpscQueue<int16_t, 16384>;
+
+#endif
@@ -0,0 +1,446 @@
+// Entry point of McGB_bench, micro-benchmarks of the CPU core and bus plus a few macro-benchmarks
+// Every benchmark is rerun with more iterations until it takes at least --min-time, results are printed one per line
+// as JSON (default) or CSV so two commits can be compared with a diff or a script
+//
+//   ./McGB_bench [--filter TEXT] [--min-time MS] [--csv] [--rom PATH] [--jit]
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "gameboy.h"
+#include "jit.h"
+#include "pixel_kernels.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the compiler from throwing away a result that nothing reads
+template <typename T>
+inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+struct Options {
+    std::string filter;
+    double min_time = 0.2;      // Seconds
+    bool csv = false;
+    std::string rom_path;
+    bool jit = false;           // Macro benchmarks run with the JIT attached
+};
+
+Options options;
+
+void report(const std::string& name, double value, const char* unit, uint64_t iterations) {
+    if (options.csv) {
+        std::printf("%s,%.4f,%s,%llu\n", name.c_str(), value, unit, (unsigned long long)iterations);
+    } else {
+        std::printf("{\"name\":\"%s\",\"value\":%.4f,\"unit\":\"%s\",\"iterations\":%llu}\n",
+                    name.c_str(), value, unit, (unsigned long long)iterations);
+    }
+    std::fflush(stdout);
+}
+
+bool selected(const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+// A JIT for `cpu` when --jit was given, detached again when it goes away
+struct JitAttachment {
+    CPU& cpu;
+    std::unique_ptr<Jit> jit;
+
+    explicit JitAttachment(CPU& cpu) : cpu(cpu) {
+        if (options.jit) {
+            jit = std::make_unique<Jit>(cpu);
+            cpu.jit = jit.get();
+        }
+    }
+    ~JitAttachment() {
+        cpu.jit = nullptr;
+    }
+};
+
+// Calls `body(iterations)` with a growing iteration count until a run takes at least min_time
+// Returns the seconds of the last run and the iteration count it used
+double measure(const std::function<void(uint64_t)>& body, uint64_t& iterations) {
+    iterations = 1024;
+    while (true) {
+        auto start = Clock::now();
+        body(iterations);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= options.min_time || iterations >= (1ull << 40)) {
+            return seconds;
+        }
+        // Aim a bit past min_time so the next run is usually the last
+        double scale = seconds > 0 ? options.min_time * 1.2 / seconds : 16;
+        iterations = (uint64_t)(iterations * std::min(std::max(scale, 2.0), 16.0));
+    }
+}
+
+void bench_ns(const std::string& name, const std::function<void(uint64_t)>& body) {
+    if (!selected(name)) {
+        return;
+    }
+    uint64_t iterations = 0;
+    double seconds = measure(body, iterations);
+    report(name, seconds * 1e9 / iterations, "ns/op", iterations);
+}
+
+// ALU helpers: the result feeds the next call through A so the calls can't overlap or be folded away
+
+template <typename Op>
+void bench_alu(const std::string& name, Op op) {
+    auto gameboy = std::make_unique<GameBoy>();
+    CPU& cpu = gameboy->cpu;
+    bench_ns("alu/" + name, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            op(cpu, (uint8_t)(i * 37));
+        }
+        keep(cpu.reg.a);
+    });
+    // Same with F read back every time, the price of materializing the lazy flags
+    bench_ns("alu/" + name + "+flags", [&](uint64_t n) {
+        uint8_t flags = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            op(cpu, (uint8_t)(i * 37) ^ flags);
+            flags = cpu.reg.f.to_uint8();
+        }
+        keep(flags);
+    });
+}
+
+void alu_benchmarks() {
+    bench_alu("add", [](CPU& cpu, uint8_t v) { cpu.add(v); });
+    bench_alu("adc", [](CPU& cpu, uint8_t v) { cpu.adc(v); });
+    bench_alu("sub", [](CPU& cpu, uint8_t v) { cpu.sub(v); });
+    bench_alu("sbc", [](CPU& cpu, uint8_t v) { cpu.sbc(v); });
+    bench_alu("compare", [](CPU& cpu, uint8_t v) { cpu.compare(v); cpu.reg.a ^= v; });
+    bench_alu("and", [](CPU& cpu, uint8_t v) { cpu.bitwise_and(v | 0x81); });
+    bench_alu("or", [](CPU& cpu, uint8_t v) { cpu.bitwise_or(v); cpu.reg.a ^= 0x5A; });
+    bench_alu("xor", [](CPU& cpu, uint8_t v) { cpu.bitwise_xor(v); });
+    bench_alu("inc", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.inc(cpu.reg.a ^ v); });
+    bench_alu("dec", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.dec(cpu.reg.a ^ v); });
+    bench_alu("daa", [](CPU& cpu, uint8_t v) { cpu.add(v); cpu.daa(); });
+    bench_alu("addhl", [](CPU& cpu, uint8_t v) { cpu.addhl((uint16_t)(v * 0x0101)); cpu.reg.a = cpu.reg.h; });
+    bench_alu("add_sp", [](CPU& cpu, uint8_t v) { cpu.reg.sp = cpu.add_sp((int8_t)v); cpu.reg.a = cpu.reg.sp_low; });
+    bench_alu("rlc", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.rlc(cpu.reg.a ^ v); });
+    bench_alu("rrc", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.rrc(cpu.reg.a ^ v); });
+    bench_alu("rl", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.rl(cpu.reg.a ^ v); });
+    bench_alu("rr", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.rr(cpu.reg.a ^ v); });
+    bench_alu("sla", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.sla(cpu.reg.a ^ v); });
+    bench_alu("sra", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.sra(cpu.reg.a ^ v); });
+    bench_alu("swap", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.swap(cpu.reg.a ^ v); });
+    bench_alu("srl", [](CPU& cpu, uint8_t v) { cpu.reg.a = cpu.srl(cpu.reg.a ^ v); });
+    bench_alu("bit", [](CPU& cpu, uint8_t v) { cpu.bit(v & 7, cpu.reg.a); cpu.reg.a += v; });
+}
+
+// Decode/dispatch: CPU::execute on opcodes that stay on registers, so the table lookup and call dominate
+
+void dispatch_benchmarks() {
+    auto gameboy = std::make_unique<GameBoy>();
+    CPU& cpu = gameboy->cpu;
+
+    bench_ns("dispatch/execute_nop", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            cpu.execute(0x00);
+        }
+        keep(cpu.cycles);
+    });
+
+    // LD r,r' and ALU A,r with register operands, in random order so branch prediction doesn't learn the sequence
+    std::vector<uint8_t> opcodes;
+    std::mt19937 rng(1234);
+    while (opcodes.size() < 4096) {
+        uint8_t opcode = (uint8_t)(0x40 + rng() % 0x80);
+        if ((opcode & 0x07) == 6 || (opcode >= 0x70 && opcode < 0x78)) {
+            continue;   // (HL) operands and HALT
+        }
+        opcodes.push_back(opcode);
+    }
+    bench_ns("dispatch/execute_mixed", [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            cpu.execute(opcodes[i & 4095]);
+        }
+        keep(cpu.cycles);
+    });
+}
+
+// Bus: one benchmark per region, addresses walk through the region so every page is touched
+// They are worked out up front, a modulo per access would cost more than the access itself
+
+std::vector<uint16_t> region_addresses(uint16_t base, uint16_t size) {
+    std::vector<uint16_t> addresses(4096);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        addresses[i] = (uint16_t)(base + (i * 97) % size);
+    }
+    return addresses;
+}
+
+void bench_read(const std::string& name, Bus& bus, uint16_t base, uint16_t size) {
+    std::vector<uint16_t> addresses = region_addresses(base, size);
+    bench_ns("bus/read_" + name, [&](uint64_t n) {
+        uint8_t sum = 0;
+        for (uint64_t i = 0; i < n; i++) {
+            sum += bus.read_memory(addresses[i & 4095]);
+        }
+        keep(sum);
+    });
+}
+
+void bench_write(const std::string& name, Bus& bus, uint16_t base, uint16_t size) {
+    std::vector<uint16_t> addresses = region_addresses(base, size);
+    bench_ns("bus/write_" + name, [&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            bus.write_memory((uint8_t)i, addresses[i & 4095]);
+        }
+        keep(bus.high);
+    });
+}
+
+void bus_benchmarks() {
+    auto gameboy = std::make_unique<GameBoy>();
+    Bus& bus = gameboy->bus;
+    bench_read("rom", bus, 0x0000, 0x8000);
+    bench_read("vram", bus, 0x8000, 0x2000);
+    bench_read("wram", bus, 0xC000, 0x2000);
+    bench_read("echo", bus, 0xE000, 0x1E00);
+    bench_read("oam", bus, 0xFE00, 0xA0);
+    bench_read("io", bus, 0xFF40, 0x0C);    // LCD registers, partly hooked
+    bench_read("hram", bus, 0xFF80, 0x7F);
+    bench_write("rom", bus, 0x0000, 0x8000);
+    bench_write("vram", bus, 0x8000, 0x2000);
+    bench_write("wram", bus, 0xC000, 0x2000);
+    bench_write("hram", bus, 0xFF80, 0x7F);
+}
+
+// Pixel kernels, every level the host supports
+
+void kernel_benchmarks() {
+    using namespace PixelKernels;
+    std::vector<uint8_t> tile_data(PPU::TILE_COUNT * 16);
+    std::vector<uint8_t> indices(PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT);
+    std::mt19937 rng(7);
+    for (uint8_t& byte : tile_data) {
+        byte = (uint8_t)rng();
+    }
+    for (uint8_t& index : indices) {
+        index = (uint8_t)(rng() & 3);
+    }
+    std::vector<uint8_t> pixels(64);
+    std::vector<uint8_t> shades(indices.size());
+    std::vector<uint32_t> rgba(indices.size());
+    const uint32_t colors[4] = {0xFFFFFFFF, 0xAAAAAAFF, 0x555555FF, 0x000000FF};
+
+    for (Level level : {Level::scalar, Level::sse2, Level::avx2}) {
+        if (!supported(level)) {
+            continue;
+        }
+        const Table& kernels = table(level);
+        std::string prefix = std::string("kernels/") + name(level) + "/";
+        bench_ns(prefix + "decode_tile", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                kernels.decode_tile(&tile_data[(i % PPU::TILE_COUNT) * 16], pixels.data());
+                keep(pixels[0]);
+            }
+        });
+        bench_ns(prefix + "map_shades_frame", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                kernels.map_shades(indices.data(), shades.data(), indices.size(), (uint8_t)(0xE4 ^ i));
+                keep(shades[0]);
+            }
+        });
+        bench_ns(prefix + "map_rgba_frame", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; i++) {
+                kernels.map_rgba(shades.data(), rgba.data(), shades.size(), colors);
+                keep(rgba[0]);
+            }
+        });
+    }
+}
+
+// Macro-benchmarks: fixed programs placed at 0x0100
+
+struct Program {
+    std::vector<uint8_t> bytes;
+
+    void emit(std::initializer_list<uint8_t> list) {
+        bytes.insert(bytes.end(), list);
+    }
+    uint16_t here() const { return (uint16_t)(0x0100 + bytes.size()); }
+    // JR cc to an address already emitted
+    void jr_back(uint8_t opcode, uint16_t target) {
+        emit({opcode, (uint8_t)(int8_t)(target - (here() + 2))});
+    }
+    void load(GameBoy& gameboy) const {
+        std::copy(bytes.begin(), bytes.end(), gameboy.bus.rom.begin() + 0x0100);
+        gameboy.cpu.reset();
+    }
+};
+
+// 256 random register-only LD/ALU instructions and a JP back
+Program alu_stream() {
+    Program program;
+    std::mt19937 rng(42);
+    for (int i = 0; i < 256;) {
+        uint8_t opcode = (uint8_t)(0x40 + rng() % 0x80);
+        if ((opcode & 0x07) == 6 || (opcode >= 0x70 && opcode < 0x78)) {
+            continue;
+        }
+        program.emit({opcode});
+        i++;
+    }
+    program.emit({0xC3, 0x00, 0x01});
+    return program;
+}
+
+// A loop mixing memory accesses, CB ops, the stack and branches
+Program mixed_stream(bool interrupts) {
+    Program program;
+    if (interrupts) {
+        program.emit({0x3E, 0x05, 0xE0, 0x07});     // ld a,5 ; ldh (TAC),a     timer on
+        program.emit({0x3E, 0x05, 0xE0, 0xFF});     // ld a,5 ; ldh (IE),a      VBlank + timer
+        program.emit({0xFB});                       // ei
+    }
+    uint16_t outer = program.here();
+    program.emit({0x21, 0x00, 0xC0});   // ld hl,C000
+    program.emit({0x06, 0x00});         // ld b,0
+    uint16_t loop = program.here();
+    program.emit({0x2A});               // ld a,(hl+)
+    program.emit({0x80});               // add a,b
+    program.emit({0xCB, 0x37});         // swap a
+    program.emit({0xE6, 0x0F});         // and 0F
+    program.emit({0x77});               // ld (hl),a
+    program.emit({0xC5});               // push bc
+    program.emit({0xD1});               // pop de
+    program.emit({0x13});               // inc de
+    program.emit({0xCB, 0x7A});         // bit 7,d
+    program.emit({0x28, 0x01});         // jr z,+1
+    program.emit({0x00});               // nop
+    program.emit({0x05});               // dec b
+    program.jr_back(0x20, loop);        // jr nz,loop
+    program.emit({0xC3, (uint8_t)(outer & 0xFF), (uint8_t)(outer >> 8)});
+    return program;
+}
+
+void bench_mips(const std::string& name, const Program& program) {
+    if (!selected(name)) {
+        return;
+    }
+    auto gameboy = std::make_unique<GameBoy>();
+    program.load(*gameboy);
+    CPU& cpu = gameboy->cpu;
+
+    // The programs are fixed loops, so the average cycles per instruction measured once holds for the timed run
+    uint64_t start_cycles = cpu.cycles;
+    const int calibration = 100000;
+    for (int i = 0; i < calibration; i++) {
+        cpu.step();
+    }
+    double cycles_per_instruction = (double)(cpu.cycles - start_cycles) / calibration;
+
+    JitAttachment jit(cpu);
+    uint64_t iterations = 0;
+    double seconds = measure([&](uint64_t n) {
+        cpu.run(cpu.cycles + n);
+    }, iterations);
+    double instructions = iterations / cycles_per_instruction;
+    report(name, instructions / seconds / 1e6, "MIPS", iterations);
+}
+
+void bench_fps(const std::string& name, GameBoy& gameboy) {
+    if (!selected(name)) {
+        return;
+    }
+    JitAttachment jit(gameboy.cpu);
+    uint64_t iterations = 0;
+    double seconds = measure([&](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+            gameboy.run_frame();
+        }
+    }, iterations);
+    double fps = iterations / seconds;
+    report(name, fps, "frames/s", iterations);
+    report(name + "_speed", fps / (4194304.0 / PPU::FRAME_CYCLES), "x realtime", iterations);
+}
+
+void macro_benchmarks() {
+    bench_mips("macro/alu_stream", alu_stream());
+    bench_mips("macro/mixed_stream", mixed_stream(false));
+
+    // Whole machine: CPU, scheduler, timer and PPU with VBlank/timer interrupts (vectors hold RETI)
+    auto gameboy = std::make_unique<GameBoy>();
+    for (uint16_t vector = 0x40; vector <= 0x60; vector += 8) {
+        gameboy->bus.rom[vector] = 0xD9;
+    }
+    mixed_stream(true).load(*gameboy);
+    bench_fps("macro/frames", *gameboy);
+
+    if (!options.rom_path.empty()) {
+        auto cartridge = std::make_unique<GameBoy>();
+        if (cartridge->insert_cartridge(options.rom_path)) {
+            bench_fps("macro/rom_frames", *cartridge);
+        } else {
+            std::fprintf(stderr, "Failed to load ROM: %s\n", options.rom_path.c_str());
+        }
+    }
+}
+
+bool parse_args(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--filter") == 0 && has_value) {
+            options.filter = argv[++i];
+        } else if (std::strcmp(arg, "--min-time") == 0 && has_value) {
+            options.min_time = std::atof(argv[++i]) / 1000.0;
+        } else if (std::strcmp(arg, "--csv") == 0) {
+            options.csv = true;
+        } else if (std::strcmp(arg, "--rom") == 0 && has_value) {
+            options.rom_path = argv[++i];
+        } else if (std::strcmp(arg, "--jit") == 0) {
+            options.jit = true;
+        } else {
+            return false;
+        }
+    }
+    return options.min_time > 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    spdlog::set_level(spdlog::level::off);
+
+    if (!parse_args(argc, argv)) {
+        std::printf("Usage: %s [--filter TEXT] [--min-time MS] [--csv] [--rom PATH] [--jit]\n", argv[0]);
+        return 1;
+    }
+    if (options.jit && !Jit::supported()) {
+        std::fprintf(stderr, "The JIT can't run here, --jit is ignored\n");
+    }
+    if (options.csv) {
+        std::printf("name,value,unit,iterations\n");
+    }
+
+    alu_benchmarks();
+    dispatch_benchmarks();
+    bus_benchmarks();
+    kernel_benchmarks();
+    macro_benchmarks();
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "blip_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+BlipBuffer::BlipBuffer(size_t capacity) : buffer(capacity + WIDTH, 0) {}
+
+void BlipBuffer::set_rates(double clock_rate, double sample_rate) {
+    factor = (uint64_t)std::llround(sample_rate / clock_rate * (double)(1ull << FRAC_BITS));
+}
+
+void BlipBuffer::end_frame(uint32_t duration) {
+    offset += duration * factor;
+    available = std::min(available + (size_t)(offset >> FRAC_BITS), buffer.size() - WIDTH);
+    offset &= (1ull << FRAC_BITS) - 1;
+}
+
+size_t BlipBuffer::read_samples(int16_t* out, size_t count, size_t stride) {
+    count = std::min(count, available);
+    for (size_t i = 0; i < count; i++) {
+        integrator += buffer[i];
+        int64_t level = integrator >> KERNEL_BITS;
+        int64_t sample = level - (dc >> 16);
+        dc += ((level << 16) - dc) >> 10;   // ~7 Hz high-pass at 48 kHz
+        out[i * stride] = (int16_t)std::clamp<int64_t>(sample, INT16_MIN, INT16_MAX);
+    }
+    // Move what's left (the tail of the last steps included) to the front
+    size_t remaining = buffer.size() - count;
+    std::memmove(buffer.data(), buffer.data() + count, remaining * sizeof(int32_t));
+    std::fill(buffer.begin() + remaining, buffer.end(), 0);
+    available -= count;
+    return count;
+}
+
+void BlipBuffer::clear() {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    offset = 0;
+    available = 0;
+    integrator = 0;
+    dc = 0;
+}
+
+// Impulse response of the band-limited step for every sub-sample phase: a Blackman windowed sinc with its cutoff a
+// bit under Nyquist, each phase rounded so it sums to exactly 1 << KERNEL_BITS (steps must add up with no drift)
+const BlipBuffer::Kernel& BlipBuffer::kernel() {
+    static const Kernel table = []() {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.9;
+        const double half = WIDTH / 2;
+        Kernel kernel{};
+        for (int phase = 0; phase < PHASES; phase++) {
+            double taps[WIDTH];
+            double sum = 0;
+            for (int i = 0; i < WIDTH; i++) {
+                double x = i - half + 1 - (double)phase / PHASES;
+                double sinc = x == 0 ? 1.0 : std::sin(pi * x * cutoff) / (pi * x * cutoff);
+                double window = 0.42 + 0.5 * std::cos(pi * x / half) + 0.08 * std::cos(2 * pi * x / half);
+                taps[i] = sinc * window;
+                sum += taps[i];
+            }
+            int32_t total = 0;
+            for (int i = 0; i < WIDTH; i++) {
+                kernel[phase][i] = (int32_t)std::lround(taps[i] / sum * (1 << KERNEL_BITS));
+                total += kernel[phase][i];
+            }
+            kernel[phase][WIDTH / 2 - 1] += (1 << KERNEL_BITS) - total;
+        }
+        return kernel;
+    }();
+    return table;
+}
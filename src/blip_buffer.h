@@ -0,0 +1,57 @@
+// Header file for the BlipBuffer
+// Band-limited step synthesis: a sound channel only reports the moments its output level changes (in CPU cycles) and
+// each change is added as a band-limited step straight at the output sample rate. Nothing runs at the 4 MHz clock
+// and there is no decimation filter, a square wave costs a handful of multiply-adds per edge
+// Deltas are stored as impulses and summed up (integrated) when samples are read, followed by a DC blocker since
+// the DMG channels have a large DC offset
+#ifndef BLIP_BUFFER_H
+#define BLIP_BUFFER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct BlipBuffer {
+    static constexpr int PHASE_BITS = 5;                    // Sub-sample position resolution (32 steps)
+    static constexpr int PHASES = 1 << PHASE_BITS;
+    static constexpr int WIDTH = 16;                        // Taps per step
+    static constexpr int KERNEL_BITS = 14;                  // A kernel sums to 1 << KERNEL_BITS
+    static constexpr int FRAC_BITS = 32;                    // Fixed point of sample positions
+
+    using Kernel = std::array<std::array<int32_t, WIDTH>, PHASES>;
+
+    uint64_t factor = 0;        // Samples per clock cycle, FRAC_BITS fixed point
+    uint64_t offset = 0;        // Fraction of a sample where the current frame starts
+    size_t available = 0;       // Complete samples ready to read
+    std::vector<int32_t> buffer;
+    int64_t integrator = 0;
+    int64_t dc = 0;             // DC blocker state, level << 16
+
+    explicit BlipBuffer(size_t capacity);
+
+    void set_rates(double clock_rate, double sample_rate);
+    // Adds a step of `delta` at `time` cycles after the start of the current frame
+    void add_delta(uint32_t time, int32_t delta) {
+        uint64_t position = offset + time * factor;
+        size_t index = available + (size_t)(position >> FRAC_BITS);
+        if (index + WIDTH > buffer.size()) {
+            return;     // Nobody is reading, drop it rather than write past the end
+        }
+        const int32_t* taps = kernel()[(position >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1)].data();
+        int32_t* out = &buffer[index];
+        for (int i = 0; i < WIDTH; i++) {
+            out[i] += delta * taps[i];
+        }
+    }
+    // Closes the current frame after `duration` cycles, the samples it covered become available
+    void end_frame(uint32_t duration);
+    // Reads up to `count` samples, writing every `stride`th element of `out`. Returns how many were read
+    size_t read_samples(int16_t* out, size_t count, size_t stride);
+    void clear();
+
+private:
+    static const Kernel& kernel();
+};
+
+#endif
@@ -0,0 +1,205 @@
+#include "block_cache.h"
+
+namespace {
+
+// Bus hooks of a page with blocks in it, the access goes on to the page as it was and a write over decoded bytes
+// drops the page's blocks
+uint8_t code_page_read(void* context, uint16_t address) {
+    BlockCache::PageBlocks& page = *static_cast<BlockCache::PageBlocks*>(context);
+    const Bus::Page& original = page.cache->saved[address >> 8];
+    if (original.read) {
+        return original.read[address & 0xFF];
+    }
+    return original.on_read(original.context, address);
+}
+
+void code_page_write(void* context, uint16_t address, uint8_t value) {
+    BlockCache::PageBlocks& page = *static_cast<BlockCache::PageBlocks*>(context);
+    const Bus::Page& original = page.cache->saved[address >> 8];
+    if (original.write) {
+        original.write[address & 0xFF] = value;
+    } else {
+        original.on_write(original.context, address, value);
+    }
+    if (page.code_bytes.test(address & 0xFF)) {
+        page.rewrites++;
+        page.cache->invalidate(page);
+    }
+}
+
+// Memory that keeps its value until a scheduled event fires or the CPU writes to it: ROM, WRAM, IF, STAT, LY, HRAM and
+// IE. Banking, DIV, TIMA and the joypad are left out
+bool stable_read(uint16_t address) {
+    if (address < 0x8000 || (address >= 0xC000 && address < 0xFE00)) {
+        return true;
+    }
+    uint8_t offset = address & 0xFF;
+    return address >= 0xFF00 && (offset == 0x0F || offset == 0x41 || offset == 0x44 || offset >= 0x80);
+}
+
+// What a polling loop can be made of: loads into A from stable memory and register only LD, ALU and BIT
+bool polls(const uint8_t* code) {
+    uint8_t opcode = code[0];
+    switch (opcode) {
+        case 0x00 : return true;                                        // NOP
+        case 0xF0 : return stable_read(0xFF00 | code[1]);               // LDH A,(a8)
+        case 0xFA : return stable_read(code[1] | code[2] << 8);         // LD A,(a16)
+        case 0xC6 : case 0xCE : case 0xD6 : case 0xDE :
+        case 0xE6 : case 0xEE : case 0xF6 : case 0xFE : return true;    // ALU A,d8
+        case 0xCB : return code[1] >= 0x40 && code[1] < 0x80 && (code[1] & 7) != 6; // BIT n,r
+    }
+    bool uses_hl = (opcode & 7) == 6 || (opcode >= 0x70 && opcode < 0x78);
+    return opcode >= 0x40 && opcode < 0xC0 && !uses_hl;                // LD r,r' and ALU A,r
+}
+
+} // namespace
+
+void BlockCache::clear() {
+    for (auto& entry : pages_by_source) {
+        unhook(*entry.second);
+    }
+    pages_by_source.clear();
+    slots.fill(Slot{});
+    bus.generation++;
+}
+
+void BlockCache::invalidate_ram() {
+    for (auto& entry : pages_by_source) {
+        if (entry.second->writable) {
+            invalidate(*entry.second);
+        }
+    }
+}
+
+void BlockCache::invalidate(PageBlocks& page) {
+    unhook(page);
+    page.start.fill(NOT_DECODED);
+    page.code.clear();
+    page.code_bytes.reset();
+    page.idle_loops.reset();
+    page.runs.fill(0);
+    page.native.fill(nullptr);
+    bus.generation++;
+}
+
+void BlockCache::drop_native() {
+    for (auto& entry : pages_by_source) {
+        entry.second->runs.fill(0);
+        entry.second->native.fill(nullptr);
+    }
+}
+
+const BlockCache::Instruction* BlockCache::lookup(uint16_t address) {
+    uint8_t number = address >> 8;
+    Slot& slot = slots[number];
+    const uint8_t* mapped = bus.pages[number].read;
+    if (!slot.resolved || slot.mapped != mapped) {
+        slot = Slot{mapped, resolve(number, mapped), true};
+    }
+    if (!slot.blocks) {
+        return nullptr;
+    }
+    PageBlocks& page = *slot.blocks;
+    int32_t& index = page.start[address & 0xFF];
+    if (index == NOT_DECODED) {
+        index = build(page, address & 0xFF);
+    }
+    return index >= 0 ? &page.code[index] : nullptr;
+}
+
+// ROM (any bank), WRAM with its echo, and HRAM. Everything else is left to the interpreter
+BlockCache::PageBlocks* BlockCache::resolve(uint8_t number, const uint8_t* mapped) {
+    const uint8_t* source;
+    bool writable;
+    if (number < 0x80 && mapped) {
+        source = mapped;
+        writable = false;
+    } else if (number >= 0xC0 && number < 0xFE && mapped) {
+        source = mapped;
+        writable = true;
+    } else if (number == 0xFF) {
+        source = bus.high.data();
+        writable = true;
+    } else {
+        return nullptr;
+    }
+
+    std::unique_ptr<PageBlocks>& page = pages_by_source[source];
+    if (!page) {
+        page = std::make_unique<PageBlocks>();
+        page->cache = this;
+        page->source = source;
+        page->writable = writable;
+        page->first = number == 0xFF ? 0x80 : 0x00;
+        page->limit = number == 0xFF ? 0xFF : 0x100;
+        page->start.fill(NOT_DECODED);
+    }
+    return page.get();
+}
+
+int32_t BlockCache::build(PageBlocks& page, uint16_t offset) {
+    if (offset < page.first || page.rewrites >= MAX_REWRITES) {
+        return UNCACHEABLE;
+    }
+    int32_t start = (int32_t)page.code.size();
+    uint16_t at = offset;
+    bool ends_block = false;
+    bool polling = true;
+    while (at < page.limit && !ends_block) {
+        Instruction instruction;
+        size_t length = decode(page.source + at, page.limit - at, instruction, ends_block);
+        if (length == 0) {
+            break;
+        }
+        const uint8_t* code = page.source + at;
+        if (ends_block) {
+            // JR (cc) back to the first instruction
+            bool jr = code[0] == 0x18 || (code[0] & 0xE7) == 0x20;
+            polling = polling && jr && at + 2 + (int8_t)code[1] == offset;
+        } else {
+            polling = polling && polls(code);
+        }
+        page.code.push_back(instruction);
+        for (size_t i = 0; i < length; i++) {
+            page.code_bytes.set(at + i);
+        }
+        at += (uint16_t)length;
+    }
+    if ((int32_t)page.code.size() == start) {
+        return UNCACHEABLE;
+    }
+    page.code.push_back(Instruction{nullptr, 0, 0, 0});
+    page.idle_loops.set(offset, polling && ends_block);
+    if (page.writable && page.hooked_count == 0) {
+        hook(page);
+    }
+    return start;
+}
+
+// Every bus page backed by the same memory gets the hook, that's the page itself and its echo for WRAM
+void BlockCache::hook(PageBlocks& page) {
+    if (page.source == bus.high.data()) {
+        page.hooked_pages[page.hooked_count++] = 0xFF;
+    } else {
+        uint8_t number = (uint8_t)(0xC0 + (page.source - bus.wram.data()) / 0x100);
+        page.hooked_pages[page.hooked_count++] = number;
+        if (number + 0x20 < 0xFE) {
+            page.hooked_pages[page.hooked_count++] = (uint8_t)(number + 0x20);
+        }
+    }
+    for (int i = 0; i < page.hooked_count; i++) {
+        Bus::Page& target = bus.pages[page.hooked_pages[i]];
+        saved[page.hooked_pages[i]] = target;
+        target.write = nullptr;
+        target.context = &page;
+        target.on_read = code_page_read;
+        target.on_write = code_page_write;
+    }
+}
+
+void BlockCache::unhook(PageBlocks& page) {
+    for (int i = 0; i < page.hooked_count; i++) {
+        bus.pages[page.hooked_pages[i]] = saved[page.hooked_pages[i]];
+    }
+    page.hooked_count = 0;
+}
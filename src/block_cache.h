@@ -0,0 +1,122 @@
+// Header file for the BlockCache
+// Straight-line runs of instructions (up to the next jump/call/return, HALT or EI, or the end of the 256 byte page)
+// are decoded once into arrays of handlers with their immediate operands and cycle counts already resolved, and
+// replayed from then on (CPU::run) without fetching or decoding anything again
+// Blocks are kept per 256 byte page of the memory they were decoded from, found through the bus page the PC is in:
+// ROM bank switching just points that page somewhere else, the blocks of every bank stay around and valid
+// WRAM (and its echo) and HRAM pages with blocks in them get their bus writes hooked, a write over decoded bytes drops
+// every block of the page. Other memory (VRAM, cartridge RAM, I/O) is never cached and runs through CPU::execute
+// Each block also has a run counter and a slot for its native code, used by the JIT (jit.h) when there is one
+// Blocks that only read registers/memory nothing but a scheduled event can change and jump back to their own start
+// (polling LY, STAT or IF, or a flag an interrupt handler sets) are marked, CPU::run fast-forwards them
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "bus.h"
+
+struct CPU;
+struct JitBlock;
+
+struct BlockCache {
+    using Handler = void (*)(CPU& cpu, uint16_t operand);
+
+    struct Instruction {
+        Handler handler;        // nullptr marks the end of a block
+        uint16_t operand;       // Immediate d8/d16 (0 when there is none)
+        uint8_t length;         // Bytes, PC is moved past them before the handler runs
+        uint8_t cycles;         // Not taken count for conditional branches, like the interpreter's table
+    };
+
+    // Blocks decoded from one 256 byte page of ROM/WRAM/HRAM
+    struct PageBlocks {
+        BlockCache* cache;
+        const uint8_t* source;          // The bytes the blocks were decoded from
+        bool writable;                  // WRAM/HRAM, writes are watched while there are blocks
+        int hooked_count = 0;           // Bus pages currently hooked (WRAM has its echo too)
+        std::array<uint8_t, 2> hooked_pages;
+        unsigned rewrites = 0;          // Times code on this page was written over
+        uint16_t first;                 // Offsets that can hold code, HRAM only starts at 0x80 and ends before IE
+        uint16_t limit;
+        std::array<int32_t, 256> start; // Index in `code` of the block starting at each offset, or one of the below
+        std::vector<Instruction> code;  // Blocks back to back, each one ends with a null handler
+        std::bitset<256> code_bytes;    // Bytes some block was decoded from
+        std::bitset<256> idle_loops;    // Blocks that are a polling loop
+        std::array<uint16_t, 256> runs{};       // Replays of the block starting at each offset
+        std::array<JitBlock*, 256> native{};    // Its JIT translation, nullptr if there is none
+    };
+
+    static constexpr int32_t NOT_DECODED = -1;
+    static constexpr int32_t UNCACHEABLE = -2;  // First instruction goes across the page end, or see MAX_REWRITES
+    // Code that keeps rewriting itself would be decoded again after nearly every write, past this many times its
+    // page is left to the interpreter
+    static constexpr unsigned MAX_REWRITES = 64;
+
+    Bus& bus;
+
+    explicit BlockCache(Bus& bus) : bus(bus) {}
+    BlockCache(const BlockCache&) = delete;
+    BlockCache& operator=(const BlockCache&) = delete;
+
+    // Block starting at `address`, decoded on the first call. nullptr when it can't be cached
+    const Instruction* find(uint16_t address) {
+        const Slot& slot = slots[address >> 8];
+        if (slot.blocks && slot.mapped == bus.pages[address >> 8].read) {
+            int32_t index = slot.blocks->start[address & 0xFF];
+            if (index >= 0) {
+                return &slot.blocks->code[index];
+            }
+            if (index == UNCACHEABLE) {
+                return nullptr;
+            }
+        }
+        return lookup(address);
+    }
+    // Blocks of the page `address` is in, as of the last find() there
+    PageBlocks* page_of(uint16_t address) const {
+        return slots[address >> 8].blocks;
+    }
+
+    // Drops every block (new cartridge, CPU reset)
+    void clear();
+    // Drops the blocks of WRAM/HRAM, for when their contents are replaced behind the bus' back (save state load)
+    void invalidate_ram();
+    void invalidate(PageBlocks& page);
+    // Forgets every JIT translation (its code cache was flushed)
+    void drop_native();
+
+    // Decodes the instruction at `code`, `available` bytes of it are on the page. Returns its length, 0 if it doesn't
+    // fit, and sets `ends_block` for the ones after which PC or IME may change. Defined in CPU.cpp with the tables
+    static size_t decode(const uint8_t* code, size_t available, Instruction& out, bool& ends_block);
+
+    // Original bus pages of the hooked ones, the hook forwards to them
+    std::array<Bus::Page, 256> saved;
+
+private:
+    friend struct Jit;  // Native code looks blocks up through `slots` itself
+
+    // What each bus page pointed at when it was last looked at, and the blocks for that memory
+    struct Slot {
+        const uint8_t* mapped = nullptr;
+        PageBlocks* blocks = nullptr;
+        bool resolved = false;
+    };
+
+    std::array<Slot, 256> slots;
+    std::unordered_map<const uint8_t*, std::unique_ptr<PageBlocks>> pages_by_source;
+
+    const Instruction* lookup(uint16_t address);
+    PageBlocks* resolve(uint8_t number, const uint8_t* mapped);
+    int32_t build(PageBlocks& page, uint16_t offset);
+    void hook(PageBlocks& page);
+    void unhook(PageBlocks& page);
+};
+
+#endif
@@ -1,9 +1,88 @@
 #include "bus.h"
 
-int8_t read_memory(uint16_t address){
-    return memory[address];
+namespace {
+
+// Writes to ROM without a mapper go nowhere
+void ignore_write(void*, uint16_t, uint8_t) {}
+
+uint8_t open_bus_read(void*, uint16_t) {
+    return 0xFF;
+}
+
+// 0xFF00-0xFFFF: I/O registers go through their port hooks (if any), HRAM and IE are plain memory
+uint8_t high_page_read(void* context, uint16_t address) {
+    Bus& bus = *static_cast<Bus*>(context);
+    uint8_t offset = address & 0xFF;
+    if (offset < 0x80) {
+        const Bus::IoPort& port = bus.io_ports[offset];
+        if (port.read) {
+            return port.read(port.context, address);
+        }
+    }
+    return bus.high[offset];
+}
+
+void high_page_write(void* context, uint16_t address, uint8_t value) {
+    Bus& bus = *static_cast<Bus*>(context);
+    uint8_t offset = address & 0xFF;
+    if (offset < 0x80) {
+        const Bus::IoPort& port = bus.io_ports[offset];
+        if (port.write) {
+            port.write(port.context, address, value);
+            return;
+        }
+    }
+    bus.high[offset] = value;
+}
+
+// The upper 3 bits of IF don't exist and read as 1
+uint8_t interrupt_flag_read(void* context, uint16_t) {
+    return static_cast<Bus*>(context)->high[0x0F] | 0xE0;
+}
+
+} // namespace
+
+Bus::Bus() {
+    rom.fill(0);
+    vram.fill(0);
+    eram.fill(0);
+    wram.fill(0);
+    oam.fill(0);
+    high.fill(0);
+    io_ports.fill(IoPort{nullptr, nullptr, nullptr});
+
+    set_handlers(0x00, 256, this, open_bus_read, ignore_write);
+    map(0x00, 0x80, rom.data(), nullptr);             // 0x0000-0x7FFF ROM, read only
+    map(0x80, 0x20, vram.data(), vram.data());        // 0x8000-0x9FFF VRAM
+    map(0xA0, 0x20, eram.data(), eram.data());        // 0xA000-0xBFFF external RAM
+    map(0xC0, 0x20, wram.data(), wram.data());        // 0xC000-0xDFFF WRAM
+    map(0xE0, 0x1E, wram.data(), wram.data());        // 0xE000-0xFDFF echo of 0xC000-0xDDFF, same memory
+    map(0xFE, 1, oam.data(), oam.data());             // 0xFE00-0xFEFF OAM (+ unusable area)
+    map(0xFF, 1, nullptr, nullptr);                   // 0xFF00-0xFFFF goes through the handler below
+    set_handlers(0xFF, 1, this, high_page_read, high_page_write);
+
+    map_io(0xFF0F, this, interrupt_flag_read, nullptr);
+    high[0x0F] = Interrupt::VBLANK;     // Left set by the boot ROM
 }
 
-void write_memory(int8_t word, uint16_t address){
-    memory[address] =  word;
-}
\ No newline at end of file
+void Bus::map(uint8_t first_page, int count, const uint8_t* read, uint8_t* write) {
+    generation++;
+    for (int i = 0; i < count; i++) {
+        Page& page = pages[first_page + i];
+        page.read = read ? read + i * 0x100 : nullptr;
+        page.write = write ? write + i * 0x100 : nullptr;
+    }
+}
+
+void Bus::set_handlers(uint8_t first_page, int count, void* context, ReadHandler on_read, WriteHandler on_write) {
+    for (int i = 0; i < count; i++) {
+        Page& page = pages[first_page + i];
+        page.context = context;
+        page.on_read = on_read;
+        page.on_write = on_write;
+    }
+}
+
+void Bus::map_io(uint16_t address, void* context, ReadHandler read, WriteHandler write) {
+    io_ports[address & 0x7F] = IoPort{context, read, write};
+}
@@ -1,19 +1,94 @@
 // Header file for the Bus component
-// This defines the 64kB memory and the read write functionality of these
+// This defines the 64kB address space and the read write functionality of these
+// The address space is split into 256 pages of 256 bytes. Each page either points straight at the memory backing it
+// (ROM, WRAM...) so an access is one indexed load, or sends the access to a handler (I/O registers, mapper control)
 #ifndef BUS_H
 #define BUS_H
 
 #include <array>
 #include <cstdint>
 
-// This allocates exactly 64KB on the stack (if local) or data segment (if global)
-// If I include this header in more than 1 file inline will make sure only one memory segment is created
-inline std::array<int8_t, 65536> memory;
+// Interrupt bits, same layout in IF (0xFF0F) and IE (0xFFFF)
+namespace Interrupt {
+    constexpr uint8_t VBLANK   = 0x01;
+    constexpr uint8_t LCD_STAT = 0x02;
+    constexpr uint8_t TIMER    = 0x04;
+    constexpr uint8_t SERIAL   = 0x08;
+    constexpr uint8_t JOYPAD   = 0x10;
+}
 
-// Reads the 8 bit word in the specified adress
-int8_t read_memory(uint16_t address);
+struct Bus {
+    using ReadHandler = uint8_t (*)(void* context, uint16_t address);
+    using WriteHandler = void (*)(void* context, uint16_t address, uint8_t value);
 
-// Writes an 8 bit word into the specified memory adress
-void write_memory(int8_t word, uint16_t address);
+    struct Page {
+        const uint8_t* read;    // Start of the 256 bytes backing this page, nullptr means use on_read
+        uint8_t* write;         // Same for writes, nullptr means use on_write (ROM, I/O...)
+        void* context;
+        ReadHandler on_read;
+        WriteHandler on_write;
+    };
 
-#endif
\ No newline at end of file
+    // Hooks for a single I/O register in 0xFF00-0xFF7F, a nullptr hook falls back to plain storage in `high`
+    struct IoPort {
+        void* context;
+        ReadHandler read;
+        WriteHandler write;
+    };
+
+    std::array<Page, 256> pages;
+    std::array<IoPort, 0x80> io_ports;
+    // Bumped when the bytes behind an address may change without a write to it: pages remapped (bank switching) or
+    // the code decoded from them dropped (block_cache.h). Code being replayed from a decoded copy stops when it moves
+    uint32_t generation = 0;
+
+    // Memory owned by the bus
+    std::array<uint8_t, 0x8000> rom;    // Plain 32kB ROM, used when no cartridge mapper is plugged in
+    std::array<uint8_t, 0x2000> vram;   // 0x8000-0x9FFF
+    std::array<uint8_t, 0x2000> eram;   // 0xA000-0xBFFF, external (cartridge) RAM
+    std::array<uint8_t, 0x2000> wram;   // 0xC000-0xDFFF, also mirrored at 0xE000-0xFDFF (echo RAM)
+    std::array<uint8_t, 0x100> oam;     // 0xFE00-0xFEFF, only the first 0xA0 bytes are real OAM
+    std::array<uint8_t, 0x100> high;    // 0xFF00-0xFFFF, I/O registers, HRAM and IE
+
+    Bus();
+    // Pages point into the bus itself, a copy would point into the original
+    Bus(const Bus&) = delete;
+    Bus& operator=(const Bus&) = delete;
+
+    // Reads the 8 bit word in the specified adress
+    uint8_t read_memory(uint16_t address) {
+        const Page& page = pages[address >> 8];
+        if (page.read) {
+            return page.read[address & 0xFF];
+        }
+        return page.on_read(page.context, address);
+    }
+
+    // Writes an 8 bit word into the specified memory adress
+    void write_memory(uint8_t word, uint16_t address) {
+        const Page& page = pages[address >> 8];
+        if (page.write) {
+            page.write[address & 0xFF] = word;
+            return;
+        }
+        page.on_write(page.context, address, word);
+    }
+
+    // Sets a bit in IF, the CPU picks it up before its next instruction
+    void request_interrupt(uint8_t interrupt) {
+        high[0x0F] |= interrupt;
+    }
+    // Interrupts that are both requested and enabled
+    uint8_t pending_interrupts() const {
+        return high[0x0F] & high[0xFF] & 0x1F;
+    }
+
+    // Page table setup, `count` pages starting at `first_page` (address >> 8)
+    // Direct pointers point at the memory for the first page, the following pages continue 256 bytes further each
+    void map(uint8_t first_page, int count, const uint8_t* read, uint8_t* write);
+    void set_handlers(uint8_t first_page, int count, void* context, ReadHandler on_read, WriteHandler on_write);
+    // Hooks an I/O register (0xFF00-0xFF7F)
+    void map_io(uint16_t address, void* context, ReadHandler read, WriteHandler write);
+};
+
+#endif
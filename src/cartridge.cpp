@@ -0,0 +1,409 @@
+#include "cartridge.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "spdlog/spdlog.h"
+
+namespace {
+
+constexpr size_t ROM_BANK_SIZE = 0x4000;
+constexpr size_t RAM_BANK_SIZE = 0x2000;
+
+// Writes to 0x0000-0x7FFF are mapper register writes
+void mapper_write(void* context, uint16_t address, uint8_t value) {
+    static_cast<Cartridge*>(context)->write_register(address, value);
+}
+
+// 0xA000-0xBFFF only lands here when RAM is disabled, missing, or an MBC3 clock register is selected
+uint8_t ram_read(void* context, uint16_t) {
+    Cartridge& cart = *static_cast<Cartridge*>(context);
+    if (cart.mapper == Cartridge::Mapper::mbc3 && cart.ram_enabled && cart.ram_bank >= 0x08 && cart.ram_bank <= 0x0C) {
+        return cart.rtc_latched[cart.ram_bank - 0x08];
+    }
+    return 0xFF;
+}
+
+void ram_write(void* context, uint16_t, uint8_t value) {
+    Cartridge& cart = *static_cast<Cartridge*>(context);
+    if (cart.mapper == Cartridge::Mapper::mbc3 && cart.ram_enabled && cart.ram_bank >= 0x08 && cart.ram_bank <= 0x0C) {
+        cart.rtc_write(cart.ram_bank - 0x08, value);
+    }
+}
+
+Cartridge::Mapper mapper_from_type(uint8_t type) {
+    switch (type) {
+        case 0x00 : case 0x08 : case 0x09 :
+            return Cartridge::Mapper::none;
+        case 0x01 : case 0x02 : case 0x03 :
+            return Cartridge::Mapper::mbc1;
+        case 0x0F : case 0x10 : case 0x11 : case 0x12 : case 0x13 :
+            return Cartridge::Mapper::mbc3;
+        case 0x19 : case 0x1A : case 0x1B : case 0x1C : case 0x1D : case 0x1E :
+            return Cartridge::Mapper::mbc5;
+        default :
+            return Cartridge::Mapper::none;
+    }
+}
+
+bool mapper_supported(uint8_t type) {
+    return mapper_from_type(type) != Cartridge::Mapper::none || type == 0x00 || type == 0x08 || type == 0x09;
+}
+
+int ram_banks_from_header(uint8_t code) {
+    switch (code) {
+        case 0x02 : return 1;
+        case 0x03 : return 4;
+        case 0x04 : return 16;
+        case 0x05 : return 8;
+        default   : return 0;
+    }
+}
+
+} // namespace
+
+Cartridge::~Cartridge() {
+    unmap();
+}
+
+void Cartridge::unmap() {
+#ifdef _WIN32
+    if (mapping) UnmapViewOfFile(mapping);
+    if (mapping_handle) CloseHandle(mapping_handle);
+    if (file_handle) CloseHandle(file_handle);
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+#else
+    if (mapping) munmap(mapping, mapping_size);
+#endif
+    mapping = nullptr;
+    mapping_size = 0;
+    rom = nullptr;
+    rom_size = 0;
+    rom_copy.clear();
+}
+
+bool Cartridge::load(const std::string& path) {
+    // The new file is opened, mapped and checked on the side, the current ROM (which the bus may still point into)
+    // is only dropped once the new one is accepted
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        spdlog::error("Nao foi possivel abrir a ROM '{}' |-> {}, line {}", path, __FILE_NAME__, __LINE__);
+        return false;
+    }
+    LARGE_INTEGER size;
+    size_t file_size = GetFileSizeEx(file, &size) ? (size_t)size.QuadPart : 0;
+    HANDLE map_handle = file_size ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+    void* view = map_handle ? MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    auto release = [&]() {
+        if (view) UnmapViewOfFile(view);
+        if (map_handle) CloseHandle(map_handle);
+        CloseHandle(file);
+    };
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        spdlog::error("Nao foi possivel abrir a ROM '{}': {} |-> {}, line {}", path, std::strerror(errno), __FILE_NAME__, __LINE__);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        spdlog::error("Nao foi possivel ler o tamanho da ROM '{}': {} |-> {}, line {}", path, std::strerror(errno), __FILE_NAME__, __LINE__);
+        close(fd);
+        return false;
+    }
+    size_t file_size = (size_t)info.st_size;
+    void* view = file_size ? mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);  // The mapping stays valid after the descriptor is closed
+    if (view == MAP_FAILED) {
+        view = nullptr;
+    }
+    auto release = [&]() {
+        if (view) munmap(view, file_size);
+    };
+#endif
+    if (!view) {
+        spdlog::error("Falha ao mapear a ROM '{}' |-> {}, line {}", path, __FILE_NAME__, __LINE__);
+        release();
+        return false;
+    }
+
+    if (file_size < 0x150) {
+        spdlog::error("ROM '{}' demasiado pequena ({} bytes) |-> {}, line {}", path, file_size, __FILE_NAME__, __LINE__);
+        release();
+        return false;
+    }
+    uint8_t new_type = static_cast<const uint8_t*>(view)[0x0147];
+    if (!mapper_supported(new_type)) {
+        spdlog::error("Tipo de cartucho nao suportado: 0x{:02X} |-> {}, line {}", new_type, __FILE_NAME__, __LINE__);
+        release();
+        return false;
+    }
+
+    unmap();
+    mapping = view;
+    mapping_size = file_size;
+#ifdef _WIN32
+    file_handle = file;
+    mapping_handle = map_handle;
+#endif
+
+    if (file_size % ROM_BANK_SIZE == 0 && file_size >= 2 * ROM_BANK_SIZE) {
+        rom = static_cast<const uint8_t*>(mapping);
+        rom_size = file_size;
+    } else {
+        // Odd sized dumps (homebrew, test snippets) get padded to whole banks, reading past the end of a mapping faults
+        size_t padded = std::max(2 * ROM_BANK_SIZE, (file_size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE * ROM_BANK_SIZE);
+        rom_copy.assign(padded, 0xFF);
+        std::memcpy(rom_copy.data(), mapping, file_size);
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(mapping, mapping_size);
+#endif
+        mapping = nullptr;
+        mapping_size = 0;
+        rom = rom_copy.data();
+        rom_size = padded;
+    }
+    rom_banks = (int)(rom_size / ROM_BANK_SIZE);
+
+    // Header (0x0134-0x014F)
+    title.clear();
+    for (uint16_t address = 0x0134; address < 0x0144 && rom[address] != 0; address++) {
+        title += (char)rom[address];
+    }
+    type = new_type;
+    mapper = mapper_from_type(type);
+
+    uint8_t checksum = 0;
+    for (uint16_t address = 0x0134; address <= 0x014C; address++) {
+        checksum = checksum - rom[address] - 1;
+    }
+    if (checksum != rom[0x014D]) {
+        spdlog::warn("Checksum do cabecalho invalido em '{}' (0x{:02X} != 0x{:02X})", path, checksum, rom[0x014D]);
+    }
+
+    ram_banks = ram_banks_from_header(rom[0x0149]);
+    ram.assign(ram_banks * RAM_BANK_SIZE, 0);
+
+    ram_enabled = false;
+    bank_low = 1;
+    bank_high = 0;
+    ram_bank = 0;
+    advanced_mode = false;
+    rtc_latched.fill(0);
+    rtc_base = time(nullptr);
+    rtc_halted = false;
+    rtc_day_carry = false;
+    rtc_latch_last = 0xFF;
+
+    spdlog::info("ROM carregada: '{}' tipo 0x{:02X}, {} bancos de ROM, {} bancos de RAM{}", title, type, rom_banks, ram_banks,
+                 mapping ? " (mmap)" : "");
+    if (bus) {
+        attach(*bus);   // The pages still point at the old ROM
+    }
+    return true;
+}
+
+void Cartridge::attach(Bus& target) {
+    bus = &target;
+    low_rom_bank = -1;
+    bus->set_handlers(0x00, 0x80, this, nullptr, mapper_write);
+    bus->set_handlers(0xA0, 0x20, this, ram_read, ram_write);
+    update_rom_mapping();
+    update_ram_mapping();
+}
+
+void Cartridge::write_register(uint16_t address, uint8_t value) {
+    switch (mapper) {
+        case Mapper::none :
+            return;
+
+        case Mapper::mbc1 : {
+            if (address < 0x2000) {
+                ram_enabled = (value & 0x0F) == 0x0A;
+                update_ram_mapping();
+            } else if (address < 0x4000) {
+                bank_low = value & 0x1F;
+                if (bank_low == 0) bank_low = 1;    // Bank 0 can't be selected here, the register reads 0 as 1
+                update_rom_mapping();
+            } else if (address < 0x6000) {
+                bank_high = value & 0x03;
+                update_rom_mapping();
+                update_ram_mapping();
+            } else {
+                advanced_mode = value & 0x01;
+                update_rom_mapping();
+                update_ram_mapping();
+            }
+            return;
+        }
+
+        case Mapper::mbc3 : {
+            if (address < 0x2000) {
+                ram_enabled = (value & 0x0F) == 0x0A;
+                update_ram_mapping();
+            } else if (address < 0x4000) {
+                bank_low = value & 0x7F;
+                if (bank_low == 0) bank_low = 1;
+                update_rom_mapping();
+            } else if (address < 0x6000) {
+                ram_bank = value & 0x0F;
+                update_ram_mapping();
+            } else {
+                // Writing 0 then 1 latches the clock into the readable registers
+                if (rtc_latch_last == 0x00 && value == 0x01) {
+                    rtc_latch();
+                }
+                rtc_latch_last = value;
+            }
+            return;
+        }
+
+        case Mapper::mbc5 : {
+            if (address < 0x2000) {
+                ram_enabled = (value & 0x0F) == 0x0A;
+                update_ram_mapping();
+            } else if (address < 0x3000) {
+                bank_low = value;   // Bank 0 is allowed on MBC5
+                update_rom_mapping();
+            } else if (address < 0x4000) {
+                bank_high = value & 0x01;
+                update_rom_mapping();
+            } else if (address < 0x6000) {
+                ram_bank = value & 0x0F;
+                update_ram_mapping();
+            }
+            return;
+        }
+    }
+}
+
+// Repoints the 64 pages of 0x4000-0x7FFF (and 0x0000-0x3FFF when MBC1 mode 1 moves it), nothing is copied
+void Cartridge::update_rom_mapping() {
+    // Bank counts are powers of two on real carts, the register bits past that are ignored. Padded odd sized dumps
+    // (and 48/80kB files) aren't, whatever is left above the last bank wraps around
+    int mask = 1;
+    while (mask < rom_banks) {
+        mask <<= 1;
+    }
+    mask -= 1;
+    int low_area_bank = 0;
+    switch (mapper) {
+        case Mapper::none : rom_bank = 1; break;
+        case Mapper::mbc1 : {
+            rom_bank = (uint16_t)(((bank_high << 5) | bank_low) & mask);
+            if (advanced_mode) {
+                low_area_bank = ((bank_high << 5) & mask) % rom_banks;
+            }
+            break;
+        }
+        case Mapper::mbc3 : rom_bank = (uint16_t)(bank_low & mask); break;
+        case Mapper::mbc5 : rom_bank = (uint16_t)(((bank_high << 8) | bank_low) & mask); break;
+    }
+    rom_bank %= rom_banks;
+    if (low_area_bank != low_rom_bank) {
+        low_rom_bank = low_area_bank;
+        bus->map(0x00, 0x40, rom + (size_t)low_area_bank * ROM_BANK_SIZE, nullptr);
+    }
+    bus->map(0x40, 0x40, rom + (size_t)rom_bank * ROM_BANK_SIZE, nullptr);
+}
+
+void Cartridge::update_ram_mapping() {
+    if (mapper == Mapper::none) {
+        // No mapper means no enable register, the RAM (if any) is always there. Without RAM the bus' own external RAM
+        // stays mapped so homebrew still has somewhere to write
+        uint8_t* base = ram_banks > 0 ? ram.data() : bus->eram.data();
+        bus->map(0xA0, 0x20, base, base);
+        return;
+    }
+    int bank = -1;
+    if (ram_enabled && ram_banks > 0) {
+        switch (mapper) {
+            case Mapper::none : bank = 0; break;
+            case Mapper::mbc1 : bank = advanced_mode ? bank_high % ram_banks : 0; break;
+            case Mapper::mbc3 : bank = ram_bank < 0x08 ? ram_bank % ram_banks : -1; break;
+            case Mapper::mbc5 : bank = ram_bank % ram_banks; break;
+        }
+    }
+    if (bank < 0) {
+        bus->map(0xA0, 0x20, nullptr, nullptr);     // ram_read/ram_write handle it
+        return;
+    }
+    uint8_t* base = ram.data() + (size_t)bank * RAM_BANK_SIZE;
+    bus->map(0xA0, 0x20, base, base);
+}
+
+// MBC3 clock ____________________________________________________________________________________________________________
+time_t Cartridge::rtc_seconds() const {
+    return rtc_halted ? rtc_halted_at : time(nullptr) - rtc_base;
+}
+
+void Cartridge::rtc_set_seconds(time_t seconds) {
+    if (rtc_halted) {
+        rtc_halted_at = seconds;
+    } else {
+        rtc_base = time(nullptr) - seconds;
+    }
+}
+
+void Cartridge::rtc_latch() {
+    time_t seconds = rtc_seconds();
+    time_t days = seconds / 86400;
+    if (days > 511) {
+        // The day counter overflowed, it wraps around and the carry bit sticks until the game clears it
+        rtc_day_carry = true;
+        seconds %= (time_t)512 * 86400;
+        rtc_set_seconds(seconds);
+        days = seconds / 86400;
+    }
+    rtc_latched[0] = (uint8_t)(seconds % 60);
+    rtc_latched[1] = (uint8_t)(seconds / 60 % 60);
+    rtc_latched[2] = (uint8_t)(seconds / 3600 % 24);
+    rtc_latched[3] = (uint8_t)(days & 0xFF);
+    rtc_latched[4] = (uint8_t)(((days >> 8) & 0x01) | (rtc_halted ? 0x40 : 0) | (rtc_day_carry ? 0x80 : 0));
+}
+
+void Cartridge::rtc_write(uint8_t index, uint8_t value) {
+    time_t seconds = rtc_seconds();
+    time_t s = seconds % 60;
+    time_t m = seconds / 60 % 60;
+    time_t h = seconds / 3600 % 24;
+    time_t days = seconds / 86400 % 512;
+    switch (index) {
+        case 0 : s = value % 60; break;
+        case 1 : m = value % 60; break;
+        case 2 : h = value % 24; break;
+        case 3 : days = (days & 0x100) | value; break;
+        default: {
+            days = (days & 0xFF) | ((time_t)(value & 0x01) << 8);
+            rtc_day_carry = value & 0x80;
+            bool halt = value & 0x40;
+            time_t total = s + m * 60 + h * 3600 + days * 86400;
+            if (halt && !rtc_halted) {
+                rtc_halted = true;
+                rtc_halted_at = total;
+            } else if (!halt && rtc_halted) {
+                rtc_halted = false;
+                rtc_base = time(nullptr) - total;
+            }
+            rtc_set_seconds(total);
+            rtc_latched[index] = value;
+            return;
+        }
+    }
+    rtc_set_seconds(s + m * 60 + h * 3600 + days * 86400);
+    rtc_latched[index] = value;
+}
@@ -0,0 +1,84 @@
+// Header file for the Cartridge component
+// The ROM file is memory mapped read only and never copied, the bus pages for 0x0000-0x7FFF point straight into the
+// mapping. Bank switching (MBC1/MBC3/MBC5) just repoints those pages at another 16kB slice of the file
+#ifndef CARTRIDGE_H
+#define CARTRIDGE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "bus.h"
+
+struct Cartridge {
+    enum class Mapper { none, mbc1, mbc3, mbc5 };
+
+    // ROM image, either a read only mapping of the file or (for odd sized files) an owned padded copy
+    const uint8_t* rom = nullptr;
+    size_t rom_size = 0;        // Always a multiple of 16kB
+    int rom_banks = 0;
+    std::vector<uint8_t> rom_copy;
+    void* mapping = nullptr;    // Base of the file mapping (nullptr when rom_copy is used)
+    size_t mapping_size = 0;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+
+    // Header
+    std::string title;
+    uint8_t type = 0;
+    Mapper mapper = Mapper::none;
+
+    // External RAM, banked in 8kB slices
+    std::vector<uint8_t> ram;
+    int ram_banks = 0;
+
+    // Mapper registers
+    bool ram_enabled = false;
+    uint16_t rom_bank = 1;      // Bank seen at 0x4000-0x7FFF (already masked)
+    int low_rom_bank = -1;      // Bank mapped at 0x0000-0x3FFF, -1 until attach() maps it
+    uint8_t bank_low = 1;       // MBC1: 5 bit register at 0x2000 / MBC3: 7 bit / MBC5: low 8 bits
+    uint8_t bank_high = 0;      // MBC1: 2 bit register at 0x4000 / MBC5: 9th bit of the ROM bank
+    uint8_t ram_bank = 0;       // MBC3: 0x08-0x0C selects an RTC register instead
+    bool advanced_mode = false; // MBC1 banking mode (0x6000-0x7FFF)
+
+    // MBC3 real time clock: seconds, minutes, hours, days low, days high (bit 0 day 8, bit 6 halt, bit 7 carry)
+    std::array<uint8_t, 5> rtc_latched{};
+    time_t rtc_base = 0;        // Host time at which the clock read 0 (while running)
+    time_t rtc_halted_at = 0;   // Clock value (in seconds) while halted
+    bool rtc_halted = false;
+    bool rtc_day_carry = false;
+    uint8_t rtc_latch_last = 0xFF;
+
+    Bus* bus = nullptr;
+
+    Cartridge() = default;
+    Cartridge(const Cartridge&) = delete;
+    Cartridge& operator=(const Cartridge&) = delete;
+    ~Cartridge();
+
+    // Maps the ROM file and parses its header. Returns false (and logs why) if the file can't be used
+    bool load(const std::string& path);
+    // Points the bus pages at the cartridge and hooks the mapper registers
+    void attach(Bus& bus);
+
+    // Mapper
+    void write_register(uint16_t address, uint8_t value);
+    void update_rom_mapping();
+    void update_ram_mapping();
+
+    // MBC3 clock
+    time_t rtc_seconds() const;
+    void rtc_set_seconds(time_t seconds);
+    void rtc_latch();
+    void rtc_write(uint8_t index, uint8_t value);
+
+private:
+    void unmap();
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "display.h"
+
+#include <spdlog/spdlog.h>
+
+#include "pixel_kernels.h"
+
+Display::~Display() {
+    if (texture) {
+        SDL_DestroyTexture(texture);
+    }
+    if (renderer) {
+        SDL_DestroyRenderer(renderer);
+    }
+    if (window) {
+        SDL_DestroyWindow(window);
+    }
+}
+
+bool Display::create(const char* title, int scale) {
+    window = SDL_CreateWindow(title, PPU::SCREEN_WIDTH * scale, PPU::SCREEN_HEIGHT * scale, SDL_WINDOW_RESIZABLE);
+    if (!window) {
+        spdlog::critical("Falha ao criar a janela: {}", SDL_GetError());
+        return false;
+    }
+
+    spdlog::info("Janela criada com sucesso. Criando o renderer...");
+    renderer = SDL_CreateRenderer(window, nullptr);
+    if (!renderer) {
+        spdlog::critical("Falha ao criar o renderer: {}", SDL_GetError());
+        return false;
+    }
+    // The GPU scales the 160x144 picture by the largest whole factor that fits the window, letterboxing the rest
+    SDL_SetRenderLogicalPresentation(renderer, PPU::SCREEN_WIDTH, PPU::SCREEN_HEIGHT,
+                                     SDL_LOGICAL_PRESENTATION_INTEGER_SCALE);
+
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_XRGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                PPU::SCREEN_WIDTH, PPU::SCREEN_HEIGHT);
+    if (!texture) {
+        spdlog::critical("Falha ao criar a textura: {}", SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+
+    // Emulation runs on its own clock, vsync here only decides when a finished frame reaches the screen
+    vsync = SDL_SetRenderVSync(renderer, 1);
+    spdlog::info("Apresentacao com {}", vsync ? "vsync" : "sem vsync");
+    return true;
+}
+
+void Display::present(const uint8_t* framebuffer) {
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch)) {
+        const PixelKernels::Table& kernels = PixelKernels::active();
+        for (int y = 0; y < PPU::SCREEN_HEIGHT; y++) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + y * pitch);
+            kernels.map_rgba(framebuffer + y * PPU::SCREEN_WIDTH, row, PPU::SCREEN_WIDTH, colors);
+        }
+        SDL_UnlockTexture(texture);
+    }
+    SDL_RenderClear(renderer);
+    SDL_RenderTexture(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+}
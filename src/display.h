@@ -0,0 +1,36 @@
+// Header file for the Display (SDL frontend)
+// Shows the PPU framebuffer through a 160x144 streaming texture: the shades are mapped to pixels straight into the
+// locked texture and the GPU does the integer upscaling to the window
+// Presentation runs with vsync when the driver allows it, emulation speed doesn't depend on it (see FramePacer)
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include <cstdint>
+
+#include <SDL3/SDL.h>
+
+#include "ppu.h"
+
+struct Display {
+    SDL_Window* window = nullptr;
+    SDL_Renderer* renderer = nullptr;
+    SDL_Texture* texture = nullptr;
+
+    // Shades 0-3, lightest first (0x00RRGGBB)
+    uint32_t colors[4] = {0xE0F8D0, 0x88C070, 0x346856, 0x081820};
+
+    bool vsync = false;         // Presenting blocks until the next refresh
+
+    Display() = default;
+    Display(const Display&) = delete;
+    Display& operator=(const Display&) = delete;
+    ~Display();
+
+    // Opens a window `scale` times the LCD size. Returns false (and logs why) on failure
+    bool create(const char* title, int scale);
+
+    // Uploads and shows a frame of shades (PPU::framebuffer layout)
+    void present(const uint8_t* framebuffer);
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include "emulation_thread.h"
+
+#include <algorithm>
+#include <string>
+
+#include <spdlog/spdlog.h>
+
+#include "save_state.h"
+
+void EmulationThread::start() {
+    if (running.exchange(true)) {
+        return;
+    }
+    // ~2kB per frame on average, a minute of history fits in ~7.5MB
+    if (rewind_seconds > 0) {
+        rewind = std::make_unique<RewindBuffer>(rewind_seconds * 128 * 1024, rewind_seconds * 60);
+    }
+    thread = std::thread(&EmulationThread::loop, this);
+}
+
+void EmulationThread::stop() {
+    running.store(false);
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void EmulationThread::handle(const Command& command) {
+    switch (command.type) {
+        case Command::Type::button_down : {
+            gameboy.joypad.set_button((Joypad::Button)command.value, true);
+            break;
+        }
+        case Command::Type::button_up : {
+            gameboy.joypad.set_button((Joypad::Button)command.value, false);
+            break;
+        }
+        case Command::Type::set_speed : {
+            pacer.set_speed(command.value);
+            spdlog::info("Velocidade: {}", command.value ? std::to_string(command.value) + "x" : "sem limite");
+            break;
+        }
+        case Command::Type::save_state : {
+            SaveState::save_file(gameboy, state_path);
+            break;
+        }
+        case Command::Type::load_state : {
+            if (SaveState::load_file(gameboy, state_path) && rewind) {
+                rewind->clear();
+            }
+            break;
+        }
+        case Command::Type::set_run_ahead : {
+            run_ahead = std::min<unsigned>(command.value, MAX_RUN_AHEAD);
+            spdlog::info("Run-ahead: {} quadros", run_ahead);
+            break;
+        }
+        case Command::Type::rewind : {
+            rewinding = rewind && command.value;
+            // The newest state is the machine as it is now, going back starts with the one before
+            if (rewinding) {
+                rewind->pop(snapshot);
+                rewind_pacer.set_speed(1);
+            } else {
+                pacer.set_speed(pacer.speed);   // Frames missed while going back aren't caught up on
+            }
+            break;
+        }
+    }
+}
+
+// Dynamic rate control: the output rate moves up to 0.5% away from 48 kHz in proportion to how far the ring is from
+// its target, small enough to be inaudible and enough to absorb the drift between the two clocks
+void EmulationThread::queue_audio() {
+    static constexpr size_t TARGET = 2 * APU::SAMPLE_RATE / 60;     // Stereo frames, ~2 video frames of latency
+    static constexpr double MAX_ADJUST = 0.005;
+
+    APU& apu = gameboy.apu;
+    int16_t samples[2048];
+    size_t count;
+    while ((count = apu.read_samples(samples, sizeof(samples) / sizeof(samples[0]) / 2)) > 0) {
+        audio->push(samples, count * 2);    // On overflow the rest is dropped, the rate control will catch up
+    }
+
+    double queued = (double)(audio->size() / 2);
+    double error = std::clamp((TARGET - queued) / TARGET, -1.0, 1.0);
+    apu.set_sample_rate(APU::SAMPLE_RATE * (1.0 + MAX_ADJUST * error));
+}
+
+// `snapshot` holds the machine after the real frame
+void EmulationThread::show_run_ahead() {
+    size_t serial_length = gameboy.serial.output.size();
+    gameboy.apu.output_enabled = false;
+    for (unsigned i = 0; i < run_ahead; i++) {
+        gameboy.ppu.skip_render = i + 1 < run_ahead;
+        gameboy.run_frame();
+        gameboy.apu.end_frame(gameboy.cpu.cycles);
+    }
+    frames.write_buffer() = gameboy.ppu.framebuffer;
+    frames.publish();
+
+    SaveState::load(gameboy, snapshot.data(), snapshot.size());
+    gameboy.serial.output.resize(serial_length);
+}
+
+void EmulationThread::loop() {
+    spdlog::info("Thread de emulacao iniciada");
+    pacer.set_speed(speed);
+    FramePacer::Clock::time_point last_shown{};
+    while (running.load(std::memory_order_relaxed)) {
+        Command command;
+        while (commands.pop(command)) {
+            handle(command);
+        }
+
+        if (rewinding) {
+            if (rewind->pop(snapshot)) {
+                SaveState::load(gameboy, snapshot.data(), snapshot.size());
+                frames.write_buffer() = gameboy.ppu.framebuffer;
+                frames.publish();
+            }
+            rewind_pacer.wait();
+            continue;
+        }
+
+        // Above 1x the screen still only needs ~60 frames a second, the rest are dropped before they're drawn
+        FramePacer::Clock::time_point now = FramePacer::Clock::now();
+        bool shown = pacer.speed == 1 || now - last_shown >= FramePacer::FRAME;
+        gameboy.ppu.skip_render = skip_hidden_frames && !shown;
+        // Sound only plays at 1x, at any other speed it is muted (and not synthesized at all)
+        gameboy.apu.output_enabled = audio && pacer.speed == 1;
+        // With run-ahead the real frame is never shown, it's only drawn when rewind will want its picture
+        bool ahead = run_ahead > 0 && pacer.speed == 1;
+        if (ahead) {
+            gameboy.ppu.skip_render = !rewind;
+        }
+
+        gameboy.run_frame();
+        gameboy.apu.end_frame(gameboy.cpu.cycles);
+        if (gameboy.apu.output_enabled) {
+            queue_audio();
+        }
+        bool saved = (rewind || ahead) && SaveState::save(gameboy, snapshot);
+        if (saved && rewind) {
+            rewind->push(snapshot);
+        }
+        if (saved && ahead) {
+            show_run_ahead();
+            last_shown = now;
+        } else if (shown) {
+            frames.write_buffer() = gameboy.ppu.framebuffer;
+            frames.publish();
+            last_shown = now;
+        }
+
+        pacer.wait();
+    }
+    gameboy.ppu.skip_render = false;
+    gameboy.apu.output_enabled = false;
+    spdlog::info("Thread de emulacao terminada");
+}
@@ -0,0 +1,79 @@
+// Header file for the EmulationThread
+// Runs the GameBoy on its own thread, paced to real time. Finished frames go out through a triple buffer and the
+// frontend's input comes in through a lock-free queue, so neither side ever waits on the other
+// With an audio ring attached, the APU output goes out through it at 1x and the output rate is nudged so the ring
+// stays around its target fill: the pacer's clock and the sound card's clock never agree exactly
+// With rewind on, a state is taken after every frame and kept in a RewindBuffer. While rewinding, one state is popped
+// and shown per frame instead of emulating, always at 1x whatever the turbo speed, so going back is smooth
+// Run-ahead hides input lag the game itself adds: after each real frame the machine is saved, `run_ahead` more frames
+// are emulated with the same input, the last one is shown and the machine is restored. The extra frames are silent
+// and only the last one is drawn
+// Once started, the GameBoy belongs to this thread, everything else talks to it through `send`
+#ifndef EMULATION_THREAD_H
+#define EMULATION_THREAD_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio_ring.h"
+#include "frame_pacer.h"
+#include "gameboy.h"
+#include "rewind.h"
+#include "spsc_queue.h"
+#include "triple_buffer.h"
+
+// Something the frontend wants the emulation thread to do
+struct Command {
+    enum class Type : uint8_t { button_down, button_up, set_speed, save_state, load_state, rewind, set_run_ahead };
+    Type type;
+    uint8_t value;      // Joypad::Button for button_down/up, speed multiplier (0 = uncapped) for set_speed,
+                        // 1 = start / 0 = stop for rewind, frames (0-3) for set_run_ahead
+};
+
+struct EmulationThread {
+    using Frame = std::array<uint8_t, PPU::SCREEN_WIDTH * PPU::SCREEN_HEIGHT>;
+    static constexpr unsigned MAX_RUN_AHEAD = 3;
+
+    GameBoy& gameboy;
+    TripleBuffer<Frame> frames;
+    SpscQueue<Command, 256> commands;
+    std::atomic<bool> running{false};
+    std::thread thread;
+
+    // Set before start(), changed later through commands
+    unsigned speed = 1;                 // Multiple of real time, 0 = as fast as possible
+    bool skip_hidden_frames = true;     // Above 1x, frames that won't be presented aren't rendered either
+    AudioRing* audio = nullptr;         // Where the samples go, none = silent
+    std::string state_path;             // File for save_state/load_state
+    unsigned rewind_seconds = 60;       // History kept for rewinding, 0 = no rewind
+    unsigned run_ahead = 0;             // Frames emulated past the one shown (0-3), only at 1x
+
+    explicit EmulationThread(GameBoy& gameboy) : gameboy(gameboy) {}
+    EmulationThread(const EmulationThread&) = delete;
+    EmulationThread& operator=(const EmulationThread&) = delete;
+    ~EmulationThread() { stop(); }
+
+    void start();
+    void stop();
+    // Called from the frontend thread only. Returns false if the queue is full (the command is dropped)
+    bool send(Command command) { return commands.push(command); }
+
+private:
+    FramePacer pacer;
+    FramePacer rewind_pacer;            // Always 1x, turbo speeds (uncapped most of all) would empty the history at once
+    std::unique_ptr<RewindBuffer> rewind;
+    bool rewinding = false;
+    std::vector<uint8_t> snapshot;      // Reused for every state taken or restored
+
+    void loop();
+    void handle(const Command& command);
+    void queue_audio();
+    void show_run_ahead();
+};
+
+#endif
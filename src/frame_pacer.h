@@ -0,0 +1,41 @@
+// Header file for the FramePacer
+// Keeps the emulation at the DMG refresh rate (4194304 Hz / 70224 cycles, ~59.73 frames per second) by sleeping
+// until each frame is due. Deadlines advance by a fixed step, so sleep jitter doesn't add up into drift
+// `speed` runs it at a multiple of that (turbo), 0 means no pacing at all (fast-forward as fast as the core goes)
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <chrono>
+#include <thread>
+
+#include "ppu.h"
+
+struct FramePacer {
+    using Clock = std::chrono::steady_clock;
+    static constexpr std::chrono::nanoseconds FRAME{1000000000ull * PPU::FRAME_CYCLES / 4194304};
+
+    Clock::time_point next{};
+    bool started = false;
+    unsigned speed = 1;
+
+    void set_speed(unsigned new_speed) {
+        speed = new_speed;
+        started = false;
+    }
+
+    void wait() {
+        if (speed == 0) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        if (!started || now > next + 4 * FRAME) {
+            // First frame, or we fell far behind (debugger, suspended laptop...): start over instead of rushing
+            next = now;
+            started = true;
+        }
+        next += FRAME / speed;
+        std::this_thread::sleep_until(next);
+    }
+};
+
+#endif
@@ -0,0 +1,71 @@
+// Header file for the GameBoy (emulator instance)
+// Owns every component of one emulated machine, so several machines can run side by side
+#ifndef GAMEBOY_H
+#define GAMEBOY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "apu.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "CPU.h"
+#include "joypad.h"
+#include "ppu.h"
+#include "scheduler.h"
+#include "serial.h"
+#include "timer.h"
+
+struct GameBoy {
+    Bus bus;
+    CPU cpu;
+    Cartridge cartridge;
+    Scheduler scheduler;
+    Timer timer;
+    PPU ppu;
+    Serial serial;
+    Joypad joypad;
+    APU apu;
+
+    GameBoy() : cpu(bus), scheduler(cpu.cycles), timer(bus, scheduler), ppu(bus, scheduler), serial(bus, scheduler),
+                joypad(bus), apu(bus, scheduler) {}
+    GameBoy(const GameBoy&) = delete;
+    GameBoy& operator=(const GameBoy&) = delete;
+
+    // Maps the ROM file into the bus, returns false if it can't be loaded
+    bool insert_cartridge(const std::string& path) {
+        if (!cartridge.load(path)) {
+            return false;
+        }
+        cartridge.attach(bus);
+        cpu.reset();
+        return true;
+    }
+
+    // Runs the CPU up to the next scheduled event, fires it, and so on until `target` (in CPU cycles)
+    void run_until(uint64_t target) {
+        while (cpu.cycles < target) {
+            cpu.run(std::min(target, scheduler.next_time()));
+            scheduler.dispatch();
+        }
+    }
+
+    // Runs one instruction (or interrupt dispatch) and fires whatever became due
+    void step() {
+        cpu.step();
+        scheduler.dispatch();
+    }
+
+    // Runs until the PPU enters VBlank, or one frame worth of cycles when the LCD is off, but never past `deadline`
+    void run_frame(uint64_t deadline = Scheduler::NEVER) {
+        ppu.frame_ready = false;
+        uint64_t limit = std::min(deadline, cpu.cycles + PPU::FRAME_CYCLES);
+        while (!ppu.frame_ready && cpu.cycles < limit) {
+            cpu.run(std::min(limit, scheduler.next_time()));
+            scheduler.dispatch();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include "headless.h"
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#include "jit.h"
+#include "save_state.h"
+#include "trace.h"
+
+namespace {
+
+bool parse_number(const char* text, uint64_t& value) {
+    char* end = nullptr;
+    value = std::strtoull(text, &end, 0);   // Base 0: decimal, or hex with 0x
+    return end != text && *end == '\0';
+}
+
+const char* stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case StopReason::frames     : return "frames";
+        case StopReason::cycles     : return "cycles";
+        case StopReason::serial     : return "serial";
+        case StopReason::breakpoint : return "breakpoint";
+        case StopReason::jit_mismatch : return "jit_mismatch";
+    }
+    return "?";
+}
+
+// First difference between the machine running with the JIT and the reference one, empty if there's none
+std::string compare_machines(GameBoy& gameboy, GameBoy& reference) {
+    CPU& a = gameboy.cpu;
+    CPU& b = reference.cpu;
+    std::ostringstream out;
+    out << std::hex;
+    if (a.reg.pc != b.reg.pc || a.reg.sp != b.reg.sp || a.reg.get_af() != b.reg.get_af() ||
+        a.reg.get_bc() != b.reg.get_bc() || a.reg.get_de() != b.reg.get_de() || a.reg.get_hl() != b.reg.get_hl() ||
+        a.ime != b.ime || a.halted != b.halted || a.cycles != b.cycles) {
+        for (CPU* cpu : {&a, &b}) {
+            out << (cpu == &a ? "jit: " : "ref: ")
+                << "pc=" << cpu->reg.pc << " sp=" << cpu->reg.sp << " af=" << cpu->reg.get_af()
+                << " bc=" << cpu->reg.get_bc() << " de=" << cpu->reg.get_de() << " hl=" << cpu->reg.get_hl()
+                << " ime=" << cpu->ime << " halted=" << cpu->halted << std::dec << " cycles=" << cpu->cycles
+                << std::hex << '\n';
+        }
+        return out.str();
+    }
+    struct Region { const char* name; uint16_t base; const uint8_t* mine; const uint8_t* theirs; size_t size; };
+    for (const Region& region : {Region{"vram", 0x8000, gameboy.bus.vram.data(), reference.bus.vram.data(), 0x2000},
+                                 Region{"wram", 0xC000, gameboy.bus.wram.data(), reference.bus.wram.data(), 0x2000},
+                                 Region{"oam", 0xFE00, gameboy.bus.oam.data(), reference.bus.oam.data(), 0x100},
+                                 Region{"high", 0xFF00, gameboy.bus.high.data(), reference.bus.high.data(), 0x100}}) {
+        for (size_t i = 0; i < region.size; i++) {
+            if (region.mine[i] != region.theirs[i]) {
+                out << region.name << " 0x" << region.base + i << ": jit=0x" << (int)region.mine[i]
+                    << " ref=0x" << (int)region.theirs[i] << " (pc=0x" << a.reg.pc << ")\n";
+                return out.str();
+            }
+        }
+    }
+    return "";
+}
+
+// GameBoy::run_frame on both machines, slice by slice. False on the first difference
+bool run_frame_checked(GameBoy& gameboy, GameBoy& reference, uint64_t deadline, std::string& mismatch) {
+    gameboy.ppu.frame_ready = false;
+    reference.ppu.frame_ready = false;
+    uint64_t limit = std::min(deadline, gameboy.cpu.cycles + PPU::FRAME_CYCLES);
+    while (!gameboy.ppu.frame_ready && gameboy.cpu.cycles < limit) {
+        uint64_t target = std::min(limit, gameboy.scheduler.next_time());
+        gameboy.cpu.run(target);
+        reference.cpu.run(target);
+        CPU& a = gameboy.cpu;
+        CPU& b = reference.cpu;
+        if (a.reg.pc != b.reg.pc || a.cycles != b.cycles || a.reg.get_af() != b.reg.get_af()) {
+            mismatch = compare_machines(gameboy, reference);
+            return false;
+        }
+        gameboy.scheduler.dispatch();
+        reference.scheduler.dispatch();
+    }
+    mismatch = compare_machines(gameboy, reference);
+    return mismatch.empty();
+}
+
+} // namespace
+
+void print_headless_usage(const char* program) {
+    std::cout << "Usage: " << program << " [--headless] <rom> [options]\n"
+              << "  --frames N       stop after N frames\n"
+              << "  --cycles N       stop after N CPU cycles (T-cycles, 4194304 per second)\n"
+              << "  --serial TEXT    stop once TEXT shows up on the serial port\n"
+              << "  --break ADDR     stop when PC reaches ADDR (hex with 0x), can be repeated\n"
+              << "  --quiet          don't print the serial output\n"
+              << "  --load-state F   start from the save state in F\n"
+              << "  --save-state F   write a save state to F when the run stops\n"
+              << "  --trace F        record every instruction to F (decode with McGB_trace)\n"
+              << "  --trace-ring N   with --trace, only keep the last N instructions\n"
+              << "  --doctor         LY always reads 0x90, for comparing with gameboy-doctor logs\n"
+              << "  --jit            run hot code as native x86-64 code\n"
+              << "  --jit-check      --jit, checked against a second machine without it (error at the first difference)\n"
+              << "Without --frames or --cycles the run is capped at " << 60 * 60 << " frames\n"
+              << "Exit code: 0 stop condition met, 1 error, 2 budget ran out first\n";
+}
+
+bool parse_headless_args(int argc, char* argv[], HeadlessOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        uint64_t value = 0;
+        if (std::strcmp(arg, "--headless") == 0) {
+            continue;
+        } else if (std::strcmp(arg, "--quiet") == 0) {
+            options.print_serial = false;
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            if (!parse_number(argv[++i], options.max_frames)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--cycles") == 0 && has_value) {
+            if (!parse_number(argv[++i], options.max_cycles)) {
+                return false;
+            }
+        } else if (std::strcmp(arg, "--serial") == 0 && has_value) {
+            options.serial_match = argv[++i];
+        } else if (std::strcmp(arg, "--break") == 0 && has_value) {
+            if (!parse_number(argv[++i], value) || value > 0xFFFF) {
+                return false;
+            }
+            options.breakpoints.set(value);
+            options.has_breakpoints = true;
+        } else if (std::strcmp(arg, "--load-state") == 0 && has_value) {
+            options.load_state_path = argv[++i];
+        } else if (std::strcmp(arg, "--save-state") == 0 && has_value) {
+            options.save_state_path = argv[++i];
+        } else if (std::strcmp(arg, "--trace") == 0 && has_value) {
+            options.trace_path = argv[++i];
+        } else if (std::strcmp(arg, "--trace-ring") == 0 && has_value) {
+            if (!parse_number(argv[++i], value) || value == 0) {
+                return false;
+            }
+            options.trace_ring = (size_t)value;
+        } else if (std::strcmp(arg, "--doctor") == 0) {
+            options.doctor = true;
+        } else if (std::strcmp(arg, "--jit") == 0) {
+            options.jit = true;
+        } else if (std::strcmp(arg, "--jit-check") == 0) {
+            options.jit = true;
+            options.jit_check = true;
+        } else if (arg[0] != '-' && options.rom_path.empty()) {
+            options.rom_path = arg;
+        } else {
+            return false;
+        }
+    }
+    if (options.max_frames == 0 && options.max_cycles == 0) {
+        options.max_frames = 60 * 60;
+    }
+    return !options.rom_path.empty();
+}
+
+HeadlessResult run_headless(GameBoy& gameboy, const HeadlessOptions& options, GameBoy* reference) {
+    HeadlessResult result;
+    const uint64_t start = gameboy.cpu.cycles;
+    const uint64_t cycle_limit = options.max_cycles ? start + options.max_cycles : Scheduler::NEVER;
+
+    while (true) {
+        if (options.max_frames && result.frames >= options.max_frames) {
+            result.reason = StopReason::frames;
+            break;
+        }
+        if (gameboy.cpu.cycles >= cycle_limit) {
+            result.reason = StopReason::cycles;
+            break;
+        }
+
+        if (options.has_breakpoints) {
+            // Instruction by instruction, only paid for when a breakpoint is set
+            gameboy.ppu.frame_ready = false;
+            uint64_t frame_end = std::min(cycle_limit, gameboy.cpu.cycles + PPU::FRAME_CYCLES);
+            bool hit = false;
+            while (!gameboy.ppu.frame_ready && gameboy.cpu.cycles < frame_end) {
+                if (options.breakpoints.test(gameboy.cpu.reg.pc)) {
+                    hit = true;
+                    break;
+                }
+                gameboy.step();
+                if (reference) {
+                    reference->step();
+                }
+            }
+            if (hit) {
+                result.reason = StopReason::breakpoint;
+                break;
+            }
+            if (reference && !(result.mismatch = compare_machines(gameboy, *reference)).empty()) {
+                result.reason = StopReason::jit_mismatch;
+                break;
+            }
+        } else if (reference) {
+            if (!run_frame_checked(gameboy, *reference, cycle_limit, result.mismatch)) {
+                result.reason = StopReason::jit_mismatch;
+                break;
+            }
+        } else {
+            gameboy.run_frame(cycle_limit);
+        }
+        result.frames++;
+
+        // Serial bytes come in at most one per 4096 cycles, once a frame is often enough
+        if (!options.serial_match.empty() && gameboy.serial.output.find(options.serial_match) != std::string::npos) {
+            result.reason = StopReason::serial;
+            break;
+        }
+    }
+    result.cycles = gameboy.cpu.cycles - start;
+    return result;
+}
+
+int headless_main(const HeadlessOptions& options) {
+    auto gameboy = std::make_unique<GameBoy>();
+    if (!gameboy->insert_cartridge(options.rom_path)) {
+        std::cerr << "Failed to load ROM: " << options.rom_path << std::endl;
+        return HeadlessExit::ERROR;
+    }
+    if (!options.load_state_path.empty() && !SaveState::load_file(*gameboy, options.load_state_path)) {
+        std::cerr << "Failed to load state: " << options.load_state_path << std::endl;
+        return HeadlessExit::ERROR;
+    }
+
+    gameboy->ppu.doctor_ly = options.doctor;
+    TraceRecorder trace;
+    if (!options.trace_path.empty()) {
+        bool opened = options.trace_ring ? trace.open_ring(options.trace_path, options.trace_ring)
+                                         : trace.open(options.trace_path);
+        if (!opened) {
+            std::cerr << "Failed to create trace: " << options.trace_path << std::endl;
+            return HeadlessExit::ERROR;
+        }
+        gameboy->cpu.trace = &trace;
+    }
+
+    std::unique_ptr<Jit> jit;
+    std::unique_ptr<GameBoy> reference;
+    if (options.jit) {
+        jit = std::make_unique<Jit>(gameboy->cpu);
+        if (!jit->usable()) {
+            std::cerr << "The JIT can't run here (needs an x86-64 build with MCGB_JIT and MCGB_BLOCK_CACHE)" << std::endl;
+            return HeadlessExit::ERROR;
+        }
+        gameboy->cpu.jit = jit.get();
+    }
+    if (options.jit_check) {
+        reference = std::make_unique<GameBoy>();
+        if (!reference->insert_cartridge(options.rom_path) ||
+            (!options.load_state_path.empty() && !SaveState::load_file(*reference, options.load_state_path))) {
+            std::cerr << "Failed to load the reference machine" << std::endl;
+            return HeadlessExit::ERROR;
+        }
+        reference->ppu.doctor_ly = options.doctor;
+    }
+
+    HeadlessResult result = run_headless(*gameboy, options, reference.get());
+    gameboy->cpu.trace = nullptr;
+    gameboy->cpu.jit = nullptr;
+    trace.close();
+
+    if (options.print_serial && !gameboy->serial.output.empty()) {
+        std::cout << gameboy->serial.output;
+        if (gameboy->serial.output.back() != '\n') {
+            std::cout << '\n';
+        }
+    }
+    std::cout << "stop=" << stop_reason_name(result.reason)
+              << " frames=" << result.frames
+              << " cycles=" << result.cycles
+              << " pc=0x" << std::hex << gameboy->cpu.reg.pc << std::dec << std::endl;
+    if (jit) {
+        std::cout << "jit_blocks=" << jit->translated << std::endl;
+    }
+    if (result.reason == StopReason::jit_mismatch) {
+        std::cerr << "JIT and interpreter differ after " << result.cycles << " cycles:\n" << result.mismatch;
+        return HeadlessExit::ERROR;
+    }
+
+    if (!options.save_state_path.empty() && !SaveState::save_file(*gameboy, options.save_state_path)) {
+        std::cerr << "Failed to save state: " << options.save_state_path << std::endl;
+        return HeadlessExit::ERROR;
+    }
+
+    bool has_condition = !options.serial_match.empty() || options.has_breakpoints;
+    bool met = result.reason == StopReason::serial || result.reason == StopReason::breakpoint;
+    return (met || !has_condition) ? HeadlessExit::STOPPED : HeadlessExit::TIMEOUT;
+}
@@ -0,0 +1,57 @@
+// Header file for the headless runner
+// Runs a ROM with no window, renderer or frame pacing, as fast as the core goes, and stops on a frame/cycle budget,
+// a string showing up on the serial port or a PC breakpoint. Used by the McGB_headless target and `McGB --headless`
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "gameboy.h"
+
+struct HeadlessOptions {
+    std::string rom_path;
+    uint64_t max_frames = 0;        // 0 = no frame budget
+    uint64_t max_cycles = 0;        // 0 = no cycle budget
+    std::string serial_match;       // Stop once the serial output contains this
+    std::bitset<0x10000> breakpoints;
+    bool has_breakpoints = false;
+    bool print_serial = true;       // Dump the serial output to stdout at the end
+    std::string load_state_path;    // Start from this save state instead of power on
+    std::string save_state_path;    // Save the machine here when the run stops
+    std::string trace_path;         // Binary instruction trace (see trace.h)
+    size_t trace_ring = 0;          // Keep only the last N instructions of the trace, 0 = all of them
+    bool doctor = false;            // LY reads 0x90, to compare traces with gameboy-doctor logs
+    bool jit = false;               // Run hot blocks as native code (jit.h)
+    bool jit_check = false;         // With the JIT, also run a machine without it and stop where they differ
+};
+
+// Exit codes of a headless run
+namespace HeadlessExit {
+    constexpr int STOPPED = 0;      // Serial match or breakpoint hit, or the budget ran out when no stop condition was set
+    constexpr int ERROR = 1;        // Bad arguments or unusable ROM
+    constexpr int TIMEOUT = 2;      // The budget ran out before the stop condition was met
+}
+
+enum class StopReason { frames, cycles, serial, breakpoint, jit_mismatch };
+
+struct HeadlessResult {
+    StopReason reason = StopReason::frames;
+    uint64_t frames = 0;
+    uint64_t cycles = 0;
+    std::string mismatch;           // What differed, for jit_mismatch
+};
+
+// Parses the command line (argv[0] is skipped, `--headless` is accepted and ignored). Returns false on bad arguments
+bool parse_headless_args(int argc, char* argv[], HeadlessOptions& options);
+void print_headless_usage(const char* program);
+
+// Runs an already loaded machine until one of the stop conditions. With a `reference` (same ROM and state, no JIT)
+// both run in lockstep and are compared after every scheduler slice
+HeadlessResult run_headless(GameBoy& gameboy, const HeadlessOptions& options, GameBoy* reference = nullptr);
+// Loads the ROM, runs it, reports on stdout and returns a HeadlessExit code
+int headless_main(const HeadlessOptions& options);
+
+#endif
@@ -0,0 +1,16 @@
+// Entry point of McGB_headless, the build without SDL
+#include <spdlog/spdlog.h>
+
+#include "headless.h"
+
+int main(int argc, char* argv[]) {
+    // Core errors (illegal opcodes...) go to stderr, the file logger of the SDL build is not set up here
+    spdlog::set_level(spdlog::level::warn);
+
+    HeadlessOptions options;
+    if (!parse_headless_args(argc, argv, options)) {
+        print_headless_usage(argv[0]);
+        return HeadlessExit::ERROR;
+    }
+    return headless_main(options);
+}
@@ -0,0 +1,1066 @@
+// x86-64 backend of the JIT (jit.h)
+// Host registers inside native code, the same for every block so one can jump straight into the next:
+//   r8-r11 B C D E, rsi H, rdi L, r12 A, r13 F (packed, always up to date), rbx the cycle counter,
+//   r15 the CPU, r14 the Bus, rbp the host to SM83 flag table, rax/rcx/rdx scratch
+// Guest registers are kept zero extended in the 32 bit host registers. The stack frame has the deadline, the bus
+// generation at entry and a flag set whenever a handler page was accessed (only then can an interrupt have become
+// pending or code/mappings have changed, so only then is that checked)
+#include "jit.h"
+
+#include "CPU.h"
+
+#if defined(MCGB_JIT) && defined(MCGB_BLOCK_CACHE) && defined(__x86_64__) && !defined(_WIN32)
+#define JIT_BACKEND
+#endif
+
+#if defined(JIT_BACKEND)
+
+#include <cpuid.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace {
+
+enum Reg : int { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Jcc/SETcc condition codes
+enum Cond : uint8_t { BELOW = 0x2, ABOVE_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5 };
+
+// Group 1 ALU ops, in opcode order
+enum Alu : uint8_t { ADD, OR, ADC, SBB, AND, SUB, XOR, CMP };
+
+// Group 2 rotates/shifts (the /digit of the opcode)
+enum Shift : uint8_t { ROL = 0, ROR = 1, RCL = 2, RCR = 3, SHL = 4, SHR = 5, SAR = 7 };
+
+// Guest register, by opcode index (B C D E H L (HL) A), to host register
+constexpr int HOST[8] = {R8, R9, R10, R11, RSI, RDI, -1, R12};
+constexpr int A = R12;
+constexpr int FLAGS = R13;
+constexpr int CYCLES = RBX;
+constexpr int CPU_BASE = R15;
+constexpr int BUS_BASE = R14;
+constexpr int FLAG_TABLE = RBP;
+
+// Stack frame
+constexpr int32_t DEADLINE = 0;
+constexpr int32_t GENERATION = 8;
+constexpr int32_t SLOW = 12;
+constexpr int32_t SCRATCH = 16;
+constexpr int32_t FRAME_SIZE = 24;     // Six pushes, the return address and this keep calls 16 byte aligned
+
+// Worst case code per instruction (CALL cc with both pushes through handlers is about half of it)
+constexpr size_t MAX_INSTRUCTION_CODE = 512;
+
+struct Mem {
+    int base;
+    int32_t disp = 0;
+    int index = -1;
+    int scale = 1;
+};
+
+// Operand flags of Assembler::op
+constexpr unsigned W = 1;           // REX.W, 64 bit operands
+constexpr unsigned O16 = 2;         // 0x66, 16 bit operands
+constexpr unsigned BYTE_REG = 4;    // The reg field is an 8 bit register
+constexpr unsigned BYTE_RM = 8;     // Same for the r/m field
+
+// Just the encodings the translator uses
+struct Assembler {
+    uint8_t* at;
+
+    void u8(uint8_t value) { *at++ = value; }
+    void u16(uint16_t value) { std::memcpy(at, &value, 2); at += 2; }
+    void u32(uint32_t value) { std::memcpy(at, &value, 4); at += 4; }
+    void u64(uint64_t value) { std::memcpy(at, &value, 8); at += 8; }
+
+    // A REX prefix is forced for SPL/BPL/SIL/DIL, without one those encodings mean AH/CH/DH/BH
+    void prefix(unsigned flags, int reg, int index, int base, bool byte_rex) {
+        if (flags & O16) {
+            u8(0x66);
+        }
+        uint8_t rex = 0x40 | ((flags & W) ? 8 : 0) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+        if (rex != 0x40 || byte_rex) {
+            u8(rex);
+        }
+    }
+    void op(std::initializer_list<uint8_t> code, int reg, int rm, unsigned flags = 0) {
+        bool byte_rex = ((flags & BYTE_REG) && reg >= 4 && reg < 8) || ((flags & BYTE_RM) && rm >= 4 && rm < 8);
+        prefix(flags, reg, 0, rm, byte_rex);
+        for (uint8_t byte : code) {
+            u8(byte);
+        }
+        u8(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+    void op(std::initializer_list<uint8_t> code, int reg, const Mem& m, unsigned flags = 0) {
+        prefix(flags, reg, m.index < 0 ? 0 : m.index, m.base, (flags & BYTE_REG) && reg >= 4 && reg < 8);
+        for (uint8_t byte : code) {
+            u8(byte);
+        }
+        bool sib = m.index >= 0 || (m.base & 7) == RSP;
+        uint8_t mod = (m.disp == 0 && (m.base & 7) != RBP) ? 0x00 : (m.disp >= -128 && m.disp <= 127) ? 0x40 : 0x80;
+        u8(mod | (reg & 7) << 3 | (sib ? 4 : (m.base & 7)));
+        if (sib) {
+            uint8_t scale = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+            u8(scale << 6 | ((m.index >= 0 ? m.index : RSP) & 7) << 3 | (m.base & 7));
+        }
+        if (mod == 0x40) {
+            u8((uint8_t)m.disp);
+        } else if (mod == 0x80) {
+            u32((uint32_t)m.disp);
+        }
+    }
+
+    void mov(int dst, int src, unsigned flags = 0) { op({0x89}, src, dst, flags); }
+    void mov_imm(int dst, uint32_t value) { prefix(0, 0, 0, dst, false); u8(0xB8 | (dst & 7)); u32(value); }
+    void mov_imm64(int dst, uint64_t value) { prefix(W, 0, 0, dst, false); u8(0xB8 | (dst & 7)); u64(value); }
+    void load(int dst, const Mem& m, unsigned flags = 0) { op({0x8B}, dst, m, flags); }
+    void store(const Mem& m, int src, unsigned flags = 0) { op({0x89}, src, m, flags); }
+    void store8(const Mem& m, int src) { op({0x88}, src, m, BYTE_REG); }
+    void store8_imm(const Mem& m, uint8_t value) { op({0xC6}, 0, m); u8(value); }
+    void store16_imm(const Mem& m, uint16_t value) { op({0xC7}, 0, m, O16); u16(value); }
+    void movzx8(int dst, int src) { op({0x0F, 0xB6}, dst, src, BYTE_RM); }
+    void movzx8(int dst, const Mem& m) { op({0x0F, 0xB6}, dst, m); }
+    void movzx16(int dst, int src) { op({0x0F, 0xB7}, dst, src); }
+    void movzx16(int dst, const Mem& m) { op({0x0F, 0xB7}, dst, m); }
+    void lea(int dst, const Mem& m) { op({0x8D}, dst, m); }
+
+    void alu(Alu o, int dst, int src, unsigned flags = 0) { op({(uint8_t)(o * 8 + 1)}, src, dst, flags); }
+    void alu(Alu o, int dst, const Mem& m, unsigned flags = 0) { op({(uint8_t)(o * 8 + 3)}, dst, m, flags); }
+    void alu_imm(Alu o, int dst, int32_t value, unsigned flags = 0) {
+        if (value >= -128 && value <= 127) {
+            op({0x83}, o, dst, flags);
+            u8((uint8_t)value);
+        } else {
+            op({0x81}, o, dst, flags);
+            u32((uint32_t)value);
+        }
+    }
+    void alu8(Alu o) { op({(uint8_t)(o * 8)}, RCX, RAX); }     // al op= cl
+    void alu8_imm(Alu o, uint8_t value) { u8((uint8_t)(o * 8 + 4)); u8(value); } // al op= imm8
+    void and8(int dst, const Mem& m) { op({0x22}, dst, m, BYTE_REG); }
+    void cmp8_imm(const Mem& m, uint8_t value) { op({0x80}, CMP, m); u8(value); }
+    void cmp16(const Mem& m, int src) { op({0x39}, src, m, O16); }
+    void test_imm(int reg, uint32_t value) { op({0xF7}, 0, reg); u32(value); }
+    void test8_imm(int reg, uint8_t value) { op({0xF6}, 0, reg, BYTE_RM); u8(value); }
+    void test64(int a, int b) { op({0x85}, b, a, W); }
+    void shift(Shift s, int dst, uint8_t count) { op({0xC1}, s, dst); u8(count); }
+    void shift8(Shift s, uint8_t count) {      // al
+        if (count == 1) {
+            op({0xD0}, s, RAX);
+        } else {
+            op({0xC0}, s, RAX);
+            u8(count);
+        }
+    }
+    void inc8(bool decrement) { op({0xFE}, decrement ? 1 : 0, RAX); }     // al
+    void imul_imm(int dst, int src, int32_t value) { op({0x69}, dst, src); u32((uint32_t)value); }
+    void bt_imm(int reg, uint8_t bit) { op({0x0F, 0xBA}, 4, reg); u8(bit); }
+    void setcc(Cond c, int dst) { op({0x0F, (uint8_t)(0x90 | c)}, 0, dst, BYTE_RM); }
+    void lahf() { u8(0x9F); }
+    void movzx_edx_ah() { u8(0x0F); u8(0xB6); u8(0xD4); }
+    void push(int reg) { if (reg >= 8) u8(0x41); u8(0x50 | (reg & 7)); }
+    void pop(int reg) { if (reg >= 8) u8(0x41); u8(0x58 | (reg & 7)); }
+    void ret() { u8(0xC3); }
+    void call(int reg) { op({0xFF}, 2, reg); }
+    void jmp(int reg) { op({0xFF}, 4, reg); }
+    void jmp(const Mem& m) { op({0xFF}, 4, m); }
+
+    // Relative jumps, the version without a target returns the rel32 field for bind()
+    uint8_t* jcc(Cond c) { u8(0x0F); u8(0x80 | c); uint8_t* field = at; u32(0); return field; }
+    uint8_t* jmp() { u8(0xE9); uint8_t* field = at; u32(0); return field; }
+    void jcc(Cond c, const uint8_t* target) { bind(jcc(c), target); }
+    void jmp(const uint8_t* target) { bind(jmp(), target); }
+    void bind(uint8_t* field) { bind(field, at); }
+    static void bind(uint8_t* field, const uint8_t* target) {
+        int32_t relative = (int32_t)(target - (field + 4));
+        std::memcpy(field, &relative, 4);
+    }
+};
+
+} // namespace
+
+// Where things are, relative to the CPU (r15), the Bus (r14) and a few structs
+struct Jit::Layout {
+    int32_t r8[8];          // B C D E H L - A
+    int32_t known, operation, sp, pc, cycles, ime, ime_pending;
+    int32_t slots, slot_size, slot_mapped, slot_blocks;
+    int32_t generation, interrupt_flag, interrupt_enable;
+    int32_t pages, page_size, page_read, page_write;
+    int32_t native;         // In PageBlocks
+};
+
+namespace {
+
+using Layout = Jit::Layout;
+
+template <typename Base, typename Field>
+int32_t offset_in(const Base& base, const Field& field) {
+    return (int32_t)((const uint8_t*)&field - (const uint8_t*)&base);
+}
+
+} // namespace
+
+void Jit::find_layout() {
+    Registers& reg = cpu.reg;
+    Bus& bus = cpu.bus;
+    auto probe = std::make_unique<BlockCache::PageBlocks>();
+    layout = std::make_unique<Layout>();
+    layout->r8[0] = offset_in(cpu, reg.b);
+    layout->r8[1] = offset_in(cpu, reg.c);
+    layout->r8[2] = offset_in(cpu, reg.d);
+    layout->r8[3] = offset_in(cpu, reg.e);
+    layout->r8[4] = offset_in(cpu, reg.h);
+    layout->r8[5] = offset_in(cpu, reg.l);
+    layout->r8[6] = 0;
+    layout->r8[7] = offset_in(cpu, reg.a);
+    layout->known = offset_in(cpu, reg.f.known);
+    layout->operation = offset_in(cpu, reg.f.operation);
+    layout->sp = offset_in(cpu, reg.sp);
+    layout->pc = offset_in(cpu, reg.pc);
+    layout->cycles = offset_in(cpu, cpu.cycles);
+    layout->ime = offset_in(cpu, cpu.ime);
+    layout->ime_pending = offset_in(cpu, cpu.ime_pending);
+    layout->slots = offset_in(cpu, cpu.blocks.slots[0]);
+    layout->slot_size = offset_in(cpu.blocks.slots[0], cpu.blocks.slots[1]);
+    layout->slot_mapped = offset_in(cpu.blocks.slots[0], cpu.blocks.slots[0].mapped);
+    layout->slot_blocks = offset_in(cpu.blocks.slots[0], cpu.blocks.slots[0].blocks);
+    layout->generation = offset_in(bus, bus.generation);
+    layout->interrupt_flag = offset_in(bus, bus.high[0x0F]);
+    layout->interrupt_enable = offset_in(bus, bus.high[0xFF]);
+    layout->pages = offset_in(bus, bus.pages[0]);
+    layout->page_size = offset_in(bus.pages[0], bus.pages[1]);
+    layout->page_read = offset_in(bus.pages[0], bus.pages[0].read);
+    layout->page_write = offset_in(bus.pages[0], bus.pages[0].write);
+    layout->native = offset_in(*probe, probe->native);
+}
+
+namespace {
+
+// Called from native code. The clock is stored before, handlers schedule events off it
+uint8_t jit_read(Bus* bus, uint16_t address) {
+    return bus->read_memory(address);
+}
+
+void jit_write(Bus* bus, uint16_t address, uint8_t value) {
+    bus->write_memory(value, address);
+}
+
+// Untranslated opcodes, PC is already past the instruction like in the block cache. Native code wants F packed
+void jit_fallback(CPU* cpu, BlockCache::Handler handler, uint16_t operand) {
+    handler(*cpu, operand);
+    cpu->reg.f.from_uint8(cpu->reg.f.to_uint8());
+}
+
+// SM83 Z H C from the flags LAHF puts in AH (SF ZF - AF - PF - CF)
+uint8_t flags_from_lahf(int host) {
+    return (uint8_t)((host & 0x40 ? FlagsRegister::ZERO : 0) | (host & 0x10 ? FlagsRegister::HALF_CARRY : 0) |
+                     (host & 0x01 ? FlagsRegister::CARRY : 0));
+}
+
+struct Translator {
+    Assembler& a;
+    const Layout& layout;
+    const uint8_t* exit;
+    const uint8_t* dispatch;
+    std::vector<std::function<void()>> cold;            // Slow paths, placed after the block
+    std::vector<std::pair<uint8_t*, uint16_t>> exits;   // Jumps that leave native code with PC = second
+    bool slow_access = false;   // The instruction being translated may have gone through a handler
+
+    Mem cpu(int32_t field) const { return Mem{CPU_BASE, field}; }
+    Mem bus(int32_t field) const { return Mem{BUS_BASE, field}; }
+
+    void leave(Cond c, uint16_t pc) { exits.push_back({a.jcc(c), pc}); }
+
+    // Registers that live in caller saved host registers, and the clock
+    void spill() {
+        for (int r = 0; r < 6; r++) {
+            a.store8(cpu(layout.r8[r]), HOST[r]);
+        }
+        a.store(cpu(layout.cycles), CYCLES, W);
+    }
+    void reload() {
+        for (int r = 0; r < 6; r++) {
+            a.movzx8(HOST[r], cpu(layout.r8[r]));
+        }
+    }
+
+    // rdx = the bus page of the address in eax, zero flag set when it goes through handlers
+    void page_of(int32_t pointer) {
+        a.mov(RDX, RAX);
+        a.shift(SHR, RDX, 8);
+        a.imul_imm(RDX, RDX, layout.page_size);
+        a.load(RDX, Mem{BUS_BASE, layout.pages + pointer, RDX, 1}, W);
+        a.test64(RDX, RDX);
+    }
+
+    // eax = address (16 bits) -> eax = byte
+    void read() {
+        slow_access = true;
+        page_of(layout.page_read);
+        uint8_t* slow = a.jcc(EQUAL);
+        a.movzx8(RAX, RAX);
+        a.movzx8(RAX, Mem{RDX, 0, RAX, 1});
+        uint8_t* done = a.at;
+        cold.push_back([this, slow, done] {
+            a.bind(slow);
+            spill();
+            a.store8_imm(Mem{RSP, SLOW}, 1);
+            a.mov(RDI, BUS_BASE, W);
+            a.mov(RSI, RAX);
+            a.mov_imm64(RAX, (uint64_t)&jit_read);
+            a.call(RAX);
+            a.movzx8(RAX, RAX);
+            reload();
+            a.jmp(done);
+        });
+    }
+
+    // eax = address (16 bits), ecx = byte
+    void write() {
+        slow_access = true;
+        page_of(layout.page_write);
+        uint8_t* slow = a.jcc(EQUAL);
+        a.movzx8(RAX, RAX);
+        a.op({0x88}, RCX, Mem{RDX, 0, RAX, 1});
+        uint8_t* done = a.at;
+        cold.push_back([this, slow, done] {
+            a.bind(slow);
+            spill();
+            a.store8_imm(Mem{RSP, SLOW}, 1);
+            a.mov(RDI, BUS_BASE, W);
+            a.mov(RSI, RAX);
+            a.mov(RDX, RCX);
+            a.mov_imm64(RAX, (uint64_t)&jit_write);
+            a.call(RAX);
+            reload();
+            a.jmp(done);
+        });
+    }
+
+    // Pairs BC DE HL SP
+    void pair(int p, int dst) {
+        if (p == 3) {
+            a.movzx16(dst, cpu(layout.sp));
+            return;
+        }
+        a.mov(dst, HOST[p * 2]);
+        a.shift(SHL, dst, 8);
+        a.alu(OR, dst, HOST[p * 2 + 1]);
+    }
+    void set_pair(int p) {      // From eax, 16 bits
+        if (p == 3) {
+            a.store(cpu(layout.sp), RAX, O16);
+            return;
+        }
+        a.movzx8(HOST[p * 2 + 1], RAX);
+        a.mov(HOST[p * 2], RAX);
+        a.shift(SHR, HOST[p * 2], 8);
+    }
+
+    // 8 bit operands, (HL) goes through memory
+    void get_r8(int r, int dst) {
+        if (r == 6) {
+            pair(2, RAX);
+            read();
+            if (dst != RAX) {
+                a.mov(dst, RAX);
+            }
+        } else if (HOST[r] != dst) {
+            a.mov(dst, HOST[r]);
+        }
+    }
+    void set_r8(int r, int src) {
+        if (r == 6) {
+            if (src != RCX) {
+                a.mov(RCX, src);
+            }
+            pair(2, RAX);
+            write();
+        } else if (HOST[r] != src) {
+            a.mov(HOST[r], src);
+        }
+    }
+
+    // Stack, SP stays in memory
+    void push_byte(int src) {      // src isn't rax
+        a.movzx16(RAX, cpu(layout.sp));
+        a.alu_imm(SUB, RAX, 1);
+        a.movzx16(RAX, RAX);
+        a.store(cpu(layout.sp), RAX, O16);
+        if (src != RCX) {
+            a.mov(RCX, src);
+        }
+        write();
+    }
+    void push_value(uint16_t value) {
+        a.mov_imm(RCX, value >> 8);
+        push_byte(RCX);
+        a.mov_imm(RCX, value & 0xFF);
+        push_byte(RCX);
+    }
+    void pop_byte() {
+        a.movzx16(RAX, cpu(layout.sp));
+        a.lea(RCX, Mem{RAX, 1});
+        a.store(cpu(layout.sp), RCX, O16);
+        read();
+    }
+    void pop_pc() {             // Into eax
+        pop_byte();
+        a.store(Mem{RSP, SCRATCH}, RAX);
+        pop_byte();
+        a.shift(SHL, RAX, 8);
+        a.alu(OR, RAX, Mem{RSP, SCRATCH});
+    }
+
+    // F from the host flags of an 8 bit add/sub done in al (LAHF clobbers ah), N or'ed in
+    void arithmetic_flags(uint8_t subtraction) {
+        a.lahf();
+        a.movzx_edx_ah();
+        a.movzx8(FLAGS, Mem{FLAG_TABLE, 0, RDX, 1});
+        if (subtraction) {
+            a.alu_imm(OR, FLAGS, FlagsRegister::SUBTRACTION);
+        }
+    }
+    // dst = ZERO if al is 0
+    void zero_flag(int dst) {
+        a.alu8_imm(CMP, 1);
+        a.alu(SBB, dst, dst);
+        a.alu_imm(AND, dst, FlagsRegister::ZERO);
+    }
+    // CF = guest carry
+    void carry_in() {
+        a.bt_imm(FLAGS, 4);
+    }
+
+    // A op= ecx, bits 5-3 of the opcode: ADD ADC SUB SBC AND XOR OR CP
+    void alu(int operation) {
+        a.mov(RAX, A);
+        switch (operation) {
+            case 0 : a.alu8(ADD); arithmetic_flags(0); break;
+            case 1 : carry_in(); a.alu8(ADC); arithmetic_flags(0); break;
+            case 2 : a.alu8(SUB); arithmetic_flags(1); break;
+            case 3 : carry_in(); a.alu8(SBB); arithmetic_flags(1); break;
+            case 4 : a.alu8(AND); zero_flag(FLAGS); a.alu_imm(OR, FLAGS, FlagsRegister::HALF_CARRY); break;
+            case 5 : a.alu8(XOR); zero_flag(FLAGS); break;
+            case 6 : a.alu8(OR); zero_flag(FLAGS); break;
+            default: a.alu8(CMP); arithmetic_flags(1); return;
+        }
+        a.movzx8(A, RAX);
+    }
+
+    // 0xCB page, the operand is in al for the shifts
+    void cb(uint8_t op) {
+        uint8_t x = op >> 6;
+        uint8_t y = (op >> 3) & 7;
+        uint8_t z = op & 7;
+        get_r8(z, RAX);
+        if (x == 0) {
+            constexpr Shift shifts[8] = {ROL, ROR, RCL, RCR, SHL, SAR, ROL, SHR};
+            if (y == 2 || y == 3) {
+                carry_in();
+            }
+            if (y == 6) {   // SWAP
+                a.shift8(ROL, 4);
+                a.alu(XOR, RDX, RDX);
+            } else {
+                a.shift8(shifts[y], 1);
+                a.alu(SBB, RDX, RDX);
+                a.alu_imm(AND, RDX, FlagsRegister::CARRY);
+            }
+            zero_flag(RCX);
+            a.alu(OR, RDX, RCX);
+            a.mov(FLAGS, RDX);
+            a.movzx8(RAX, RAX);
+        } else if (x == 1) {   // BIT, carry kept
+            a.alu_imm(AND, FLAGS, FlagsRegister::CARRY);
+            a.alu_imm(OR, FLAGS, FlagsRegister::HALF_CARRY);
+            a.test8_imm(RAX, (uint8_t)(1 << y));
+            a.setcc(EQUAL, RDX);
+            a.movzx8(RDX, RDX);
+            a.shift(SHL, RDX, 7);
+            a.alu(OR, FLAGS, RDX);
+            return;
+        } else if (x == 2) {
+            a.alu_imm(AND, RAX, (uint8_t)~(1 << y));
+        } else {
+            a.alu_imm(OR, RAX, 1 << y);
+        }
+        set_r8(z, RAX);
+    }
+
+    // Untranslated opcode through its block cache handler
+    void fallback(const BlockCache::Instruction& instruction, uint16_t next) {
+        a.store16_imm(cpu(layout.pc), next);
+        spill();
+        a.store8(cpu(layout.r8[7]), A);
+        a.store8(cpu(layout.known), FLAGS);
+        a.store8_imm(cpu(layout.operation), (uint8_t)FlagsRegister::Operation::none);
+        a.mov(RDI, CPU_BASE, W);
+        a.mov_imm64(RSI, (uint64_t)instruction.handler);
+        a.mov_imm(RDX, instruction.operand);
+        a.mov_imm64(RAX, (uint64_t)&jit_fallback);
+        a.call(RAX);
+        reload();
+        a.movzx8(A, cpu(layout.r8[7]));
+        a.movzx8(FLAGS, cpu(layout.known));
+        a.load(CYCLES, cpu(layout.cycles), W);
+        a.store8_imm(Mem{RSP, SLOW}, 1);
+        slow_access = true;
+    }
+
+    // Block ends, on to the block at `pc` if it's translated and nothing stands in the way
+    void chain(uint8_t cycles, uint16_t pc) {
+        a.alu_imm(ADD, CYCLES, cycles, W);
+        a.mov_imm(RAX, pc);
+        a.jmp(dispatch);
+    }
+    void chain_to_eax(uint8_t cycles) {
+        a.alu_imm(ADD, CYCLES, cycles, W);
+        a.jmp(dispatch);
+    }
+    // Back to CPU::run no matter what (IME about to change, HALT...)
+    void stop(uint8_t cycles, uint16_t pc) {
+        a.alu_imm(ADD, CYCLES, cycles, W);
+        a.mov_imm(RAX, pc);
+        a.jmp(exit);
+    }
+
+    // Jumps over the taken path when the condition (NZ Z NC C) doesn't hold
+    uint8_t* unless(int cc) {
+        a.test_imm(FLAGS, cc < 2 ? FlagsRegister::ZERO : FlagsRegister::CARRY);
+        return a.jcc((cc & 1) ? EQUAL : NOT_EQUAL);
+    }
+
+    // Between two instructions of a block: the same checks as the block cache loop
+    void boundary(uint8_t cycles, uint16_t next) {
+        a.alu_imm(ADD, CYCLES, cycles, W);
+        if (slow_access) {
+            a.cmp8_imm(Mem{RSP, SLOW}, 0);
+            uint8_t* check = a.jcc(NOT_EQUAL);
+            uint8_t* resume = a.at;
+            cold.push_back([this, check, resume, next] {
+                a.bind(check);
+                a.store8_imm(Mem{RSP, SLOW}, 0);
+                a.load(RAX, bus(layout.generation));
+                a.alu(CMP, RAX, Mem{RSP, GENERATION});
+                leave(NOT_EQUAL, next);
+                a.cmp8_imm(cpu(layout.ime), 0);
+                a.jcc(EQUAL, resume);
+                a.movzx8(RAX, bus(layout.interrupt_flag));
+                a.and8(RAX, bus(layout.interrupt_enable));
+                a.test8_imm(RAX, 0x1F);
+                leave(NOT_EQUAL, next);
+                a.jmp(resume);
+            });
+        }
+        a.alu(CMP, CYCLES, Mem{RSP, DEADLINE}, W);
+        leave(ABOVE_EQUAL, next);
+    }
+
+    // One instruction, `last` ones end the block
+    void instruction(const uint8_t* bytes, const BlockCache::Instruction& instruction, uint16_t pc, bool last) {
+        const uint8_t op = bytes[0];
+        const uint8_t x = op >> 6;
+        const uint8_t y = (op >> 3) & 7;
+        const uint8_t z = op & 7;
+        const uint8_t p = y >> 1;
+        const uint8_t q = y & 1;
+        const uint16_t next = (uint16_t)(pc + instruction.length);
+        const uint16_t operand = instruction.operand;
+        const uint8_t cycles = instruction.cycles;
+        slow_access = false;
+
+        if (x == 1 && op != 0x76) {                                 // LD r,r
+            if (z == 6) {
+                get_r8(6, RAX);
+                set_r8(y, RAX);
+            } else {
+                set_r8(y, HOST[z]);
+            }
+        } else if (x == 2) {                                        // ALU A,r
+            get_r8(z, RCX);
+            alu(y);
+        } else if (x == 3 && z == 6) {                              // ALU A,d8
+            a.mov_imm(RCX, operand);
+            alu(y);
+        } else if (x == 0 && z == 0 && y == 0) {                    // NOP
+        } else if (x == 0 && z == 0 && y == 3) {                    // JR
+            chain(cycles, (uint16_t)(next + (int8_t)operand));
+            return;
+        } else if (x == 0 && z == 0 && y >= 4) {                    // JR cc
+            uint8_t* skip = unless(y - 4);
+            chain(cycles + 4, (uint16_t)(next + (int8_t)operand));
+            a.bind(skip);
+            chain(cycles, next);
+            return;
+        } else if (x == 0 && z == 1) {
+            if (q == 0) {                                           // LD rr,d16
+                if (p == 3) {
+                    a.store16_imm(cpu(layout.sp), operand);
+                } else {
+                    a.mov_imm(HOST[p * 2], operand >> 8);
+                    a.mov_imm(HOST[p * 2 + 1], operand & 0xFF);
+                }
+            } else {                                                // ADD HL,rr
+                pair(2, RAX);
+                if (p == 2) {
+                    a.mov(RCX, RAX);
+                } else {
+                    pair(p, RCX);
+                }
+                // Carries out of bits 11 and 15 end up in bits 12 and 16 of hl ^ rr ^ sum
+                a.mov(RDX, RAX);
+                a.alu(XOR, RDX, RCX);
+                a.alu(ADD, RAX, RCX);
+                a.alu(XOR, RDX, RAX);
+                a.alu_imm(AND, FLAGS, FlagsRegister::ZERO);
+                a.mov(RCX, RDX);
+                a.shift(SHR, RCX, 7);
+                a.alu_imm(AND, RCX, FlagsRegister::HALF_CARRY);
+                a.alu(OR, FLAGS, RCX);
+                a.shift(SHR, RDX, 12);
+                a.alu_imm(AND, RDX, FlagsRegister::CARRY);
+                a.alu(OR, FLAGS, RDX);
+                a.movzx16(RAX, RAX);
+                set_pair(2);
+            }
+        } else if (x == 0 && z == 2) {                              // LD (rr),A / LD A,(rr)
+            if (p < 2) {
+                pair(p, RAX);
+            } else {
+                pair(2, RAX);
+            }
+            if (q == 0) {
+                a.mov(RCX, A);
+                write();
+            } else {
+                read();
+                a.mov(A, RAX);
+            }
+            if (p >= 2) {                                           // HL+ / HL-
+                pair(2, RAX);
+                a.alu_imm(p == 2 ? ADD : SUB, RAX, 1);
+                a.movzx16(RAX, RAX);
+                set_pair(2);
+            }
+        } else if (x == 0 && z == 3) {                              // INC rr / DEC rr
+            pair(p, RAX);
+            a.alu_imm(q ? SUB : ADD, RAX, 1);
+            a.movzx16(RAX, RAX);
+            set_pair(p);
+        } else if (x == 0 && (z == 4 || z == 5)) {                  // INC r / DEC r, carry kept
+            get_r8(y, RAX);
+            a.inc8(z == 5);
+            a.lahf();
+            a.movzx_edx_ah();
+            a.movzx8(RCX, Mem{FLAG_TABLE, 0, RDX, 1});
+            a.alu_imm(AND, RCX, FlagsRegister::ZERO | FlagsRegister::HALF_CARRY);
+            a.alu_imm(AND, FLAGS, FlagsRegister::CARRY);
+            a.alu(OR, FLAGS, RCX);
+            if (z == 5) {
+                a.alu_imm(OR, FLAGS, FlagsRegister::SUBTRACTION);
+            }
+            a.movzx8(RAX, RAX);
+            set_r8(y, RAX);
+        } else if (x == 0 && z == 6) {                              // LD r,d8
+            if (y == 6) {
+                a.mov_imm(RCX, operand);
+                set_r8(6, RCX);
+            } else {
+                a.mov_imm(HOST[y], operand);
+            }
+        } else if (x == 0 && z == 7 && y < 4) {                     // RLCA RRCA RLA RRA, zero cleared
+            a.mov(RAX, A);
+            if (y >= 2) {
+                carry_in();
+            }
+            a.shift8((Shift)y, 1);
+            a.alu(SBB, FLAGS, FLAGS);
+            a.alu_imm(AND, FLAGS, FlagsRegister::CARRY);
+            a.movzx8(A, RAX);
+        } else if (op == 0x2F) {                                    // CPL
+            a.alu_imm(XOR, A, 0xFF);
+            a.alu_imm(OR, FLAGS, FlagsRegister::SUBTRACTION | FlagsRegister::HALF_CARRY);
+        } else if (op == 0x37) {                                    // SCF
+            a.alu_imm(AND, FLAGS, FlagsRegister::ZERO);
+            a.alu_imm(OR, FLAGS, FlagsRegister::CARRY);
+        } else if (op == 0x3F) {                                    // CCF
+            a.alu_imm(AND, FLAGS, FlagsRegister::ZERO | FlagsRegister::CARRY);
+            a.alu_imm(XOR, FLAGS, FlagsRegister::CARRY);
+        } else if (x == 3 && z == 0 && y < 4) {                     // RET cc
+            uint8_t* skip = unless(y);
+            pop_pc();
+            chain_to_eax(cycles + 12);
+            a.bind(skip);
+            chain(cycles, next);
+            return;
+        } else if (op == 0xE0 || op == 0xF0 || op == 0xE2 || op == 0xF2 || op == 0xEA || op == 0xFA) {
+            if (z == 0) {                                           // LDH (a8)
+                a.mov_imm(RAX, 0xFF00 | operand);
+            } else if (y == 4 || y == 6) {                          // LDH (C)
+                a.mov(RAX, HOST[1]);
+                a.alu_imm(OR, RAX, 0xFF00);
+            } else {                                                // LD (a16)
+                a.mov_imm(RAX, operand);
+            }
+            if (y == 4 || y == 5) {
+                a.mov(RCX, A);
+                write();
+            } else {
+                read();
+                a.mov(A, RAX);
+            }
+        } else if (op == 0xE8 || op == 0xF8) {                      // ADD SP,e8 / LD HL,SP+e8
+            a.movzx16(RCX, cpu(layout.sp));
+            a.mov(RAX, RCX);
+            a.alu8_imm(ADD, (uint8_t)operand);  // Flags come from the low byte
+            a.lahf();
+            a.movzx_edx_ah();
+            a.movzx8(FLAGS, Mem{FLAG_TABLE, 0, RDX, 1});
+            a.alu_imm(AND, FLAGS, FlagsRegister::HALF_CARRY | FlagsRegister::CARRY);
+            a.lea(RAX, Mem{RCX, (int8_t)operand});
+            a.movzx16(RAX, RAX);
+            set_pair(op == 0xE8 ? 3 : 2);
+        } else if (x == 3 && z == 1 && q == 0) {                    // POP
+            pop_byte();
+            if (p == 3) {
+                a.alu_imm(AND, RAX, 0xF0);
+                a.mov(FLAGS, RAX);
+            } else {
+                a.mov(HOST[p * 2 + 1], RAX);
+            }
+            pop_byte();
+            a.mov(p == 3 ? A : HOST[p * 2], RAX);
+        } else if (op == 0xC9 || op == 0xD9) {                      // RET / RETI
+            pop_pc();
+            if (op == 0xD9) {
+                a.store8_imm(cpu(layout.ime), 1);
+                a.alu_imm(ADD, CYCLES, cycles, W);
+                a.jmp(exit);
+            } else {
+                chain_to_eax(cycles);
+            }
+            return;
+        } else if (op == 0xE9) {                                    // JP HL
+            pair(2, RAX);
+            chain_to_eax(cycles);
+            return;
+        } else if (op == 0xF9) {                                    // LD SP,HL
+            pair(2, RAX);
+            set_pair(3);
+        } else if (x == 3 && z == 2 && y < 4) {                     // JP cc
+            uint8_t* skip = unless(y);
+            chain(cycles + 4, operand);
+            a.bind(skip);
+            chain(cycles, next);
+            return;
+        } else if (op == 0xC3) {                                    // JP
+            chain(cycles, operand);
+            return;
+        } else if (op == 0xCB) {
+            cb(bytes[1]);
+        } else if (op == 0xF3) {                                    // DI
+            a.store8_imm(cpu(layout.ime), 0);
+            a.store8_imm(cpu(layout.ime_pending), 0);
+        } else if (op == 0xFB) {                                    // EI, CPU::run flips IME before the next one
+            a.store8_imm(cpu(layout.ime_pending), 1);
+            stop(cycles, next);
+            return;
+        } else if (x == 3 && z == 4 && y < 4) {                     // CALL cc
+            uint8_t* skip = unless(y);
+            push_value(next);
+            chain(cycles + 12, operand);
+            a.bind(skip);
+            chain(cycles, next);
+            return;
+        } else if (x == 3 && z == 5 && q == 0) {                    // PUSH
+            if (p == 3) {
+                push_byte(A);
+                push_byte(FLAGS);
+            } else {
+                push_byte(HOST[p * 2]);
+                push_byte(HOST[p * 2 + 1]);
+            }
+        } else if (op == 0xCD) {                                    // CALL
+            push_value(next);
+            chain(cycles, operand);
+            return;
+        } else if (x == 3 && z == 7) {                              // RST
+            push_value(next);
+            chain(cycles, y * 8);
+            return;
+        } else {
+            // DAA, LD (a16),SP, HALT, STOP and the illegal opcodes. The ones that end blocks leave native code
+            fallback(instruction, next);
+            bool ends = false;
+            BlockCache::Instruction decoded;
+            BlockCache::decode(bytes, 3, decoded, ends);
+            if (ends) {
+                a.movzx16(RAX, cpu(layout.pc));
+                a.alu_imm(ADD, CYCLES, cycles, W);
+                a.jmp(exit);
+                return;
+            }
+        }
+
+        if (last) {
+            chain(cycles, next);    // Page end, or an instruction split across it comes next
+        } else {
+            boundary(cycles, next);
+        }
+    }
+
+    // Translates the block at `address` whose decoded instructions start at `instructions`
+    void block(const BlockCache::PageBlocks& page, uint16_t address, const BlockCache::Instruction* instructions) {
+        uint16_t pc = address;
+        for (const BlockCache::Instruction* instruction = instructions; instruction->handler; instruction++) {
+            bool last = !instruction[1].handler;
+            this->instruction(page.source + (pc & 0xFF), *instruction, pc, last);
+            pc = (uint16_t)(pc + instruction->length);
+        }
+        for (size_t i = 0; i < cold.size(); i++) {  // Slow paths can add exits (but no more slow paths)
+            cold[i]();
+        }
+        std::vector<std::pair<uint16_t, uint8_t*>> stubs;
+        for (auto& [field, target] : exits) {
+            uint8_t* stub = nullptr;
+            for (auto& [stub_pc, location] : stubs) {
+                if (stub_pc == target) {
+                    stub = location;
+                }
+            }
+            if (!stub) {
+                stub = a.at;
+                stubs.push_back({target, stub});
+                a.mov_imm(RAX, target);
+                a.jmp(exit);
+            }
+            Assembler::bind(field, stub);
+        }
+    }
+};
+
+} // namespace
+
+Jit::Jit(CPU& cpu) : cpu(cpu) {
+    if (!supported()) {
+        return;
+    }
+    void* memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        spdlog::error("Em Jit::Jit: nao foi possivel alocar o cache de codigo |-> {}, line {}", __FILE_NAME__, __LINE__);
+        return;
+    }
+    cache = static_cast<uint8_t*>(memory);
+
+    for (int i = 0; i < 256; i++) {
+        cache[i] = flags_from_lahf(i);
+    }
+    find_layout();
+    const Layout& layout = *this->layout;
+    Assembler a{cache + 256};
+
+    // exit(pc in eax): registers back into the CPU, then return from enter
+    exit = a.at;
+    a.store(Mem{CPU_BASE, layout.pc}, RAX, O16);
+    for (int r = 0; r < 6; r++) {
+        a.store8(Mem{CPU_BASE, layout.r8[r]}, HOST[r]);
+    }
+    a.store8(Mem{CPU_BASE, layout.r8[7]}, A);
+    a.store8(Mem{CPU_BASE, layout.known}, FLAGS);
+    a.store8_imm(Mem{CPU_BASE, layout.operation}, (uint8_t)FlagsRegister::Operation::none);
+    a.store(Mem{CPU_BASE, layout.cycles}, CYCLES, W);
+    a.alu_imm(ADD, RSP, FRAME_SIZE, W);
+    for (int reg : {R15, R14, R13, R12, RBP, RBX}) {
+        a.pop(reg);
+    }
+    a.ret();
+
+    // enter(cpu, deadline, code)
+    enter = a.at;
+    for (int reg : {RBX, RBP, R12, R13, R14, R15}) {
+        a.push(reg);
+    }
+    a.alu_imm(SUB, RSP, FRAME_SIZE, W);
+    a.store(Mem{RSP, DEADLINE}, RSI, W);
+    a.mov(CPU_BASE, RDI, W);
+    a.mov_imm64(BUS_BASE, (uint64_t)&cpu.bus);
+    a.load(RAX, Mem{BUS_BASE, layout.generation});
+    a.store(Mem{RSP, GENERATION}, RAX);
+    a.store8_imm(Mem{RSP, SLOW}, 0);
+    a.mov_imm64(FLAG_TABLE, (uint64_t)cache);
+    a.load(CYCLES, Mem{CPU_BASE, layout.cycles}, W);
+    for (int r = 0; r < 6; r++) {
+        a.movzx8(HOST[r], Mem{CPU_BASE, layout.r8[r]});
+    }
+    a.movzx8(A, Mem{CPU_BASE, layout.r8[7]});
+    a.movzx8(FLAGS, Mem{CPU_BASE, layout.known});
+    a.jmp(RDX);
+
+    // dispatch(pc in eax): what CPU::run would check between two blocks, then the next block's native code if the
+    // bus page it's on still maps what it was translated from
+    dispatch = a.at;
+    a.alu(CMP, CYCLES, Mem{RSP, DEADLINE}, W);
+    a.jcc(ABOVE_EQUAL, exit);
+    a.cmp8_imm(Mem{RSP, SLOW}, 0);
+    uint8_t* quiet = a.jcc(EQUAL);
+    a.store8_imm(Mem{RSP, SLOW}, 0);
+    a.load(RCX, Mem{BUS_BASE, layout.generation});
+    a.alu(CMP, RCX, Mem{RSP, GENERATION});
+    a.jcc(NOT_EQUAL, exit);
+    a.cmp8_imm(Mem{CPU_BASE, layout.ime}, 0);
+    uint8_t* masked = a.jcc(EQUAL);
+    a.movzx8(RCX, Mem{BUS_BASE, layout.interrupt_flag});
+    a.and8(RCX, Mem{BUS_BASE, layout.interrupt_enable});
+    a.test8_imm(RCX, 0x1F);
+    a.jcc(NOT_EQUAL, exit);
+    a.bind(quiet);
+    a.bind(masked);
+    a.mov(RCX, RAX);
+    a.shift(SHR, RCX, 8);
+    a.imul_imm(RDX, RCX, layout.slot_size);
+    a.load(RDX, Mem{CPU_BASE, layout.slots + layout.slot_mapped, RDX, 1}, W);
+    a.imul_imm(RCX, RCX, layout.page_size);
+    a.alu(CMP, RDX, Mem{BUS_BASE, layout.pages + layout.page_read, RCX, 1}, W);
+    a.jcc(NOT_EQUAL, exit);
+    a.mov(RCX, RAX);
+    a.shift(SHR, RCX, 8);
+    a.imul_imm(RCX, RCX, layout.slot_size);
+    a.load(RDX, Mem{CPU_BASE, layout.slots + layout.slot_blocks, RCX, 1}, W);
+    a.test64(RDX, RDX);
+    a.jcc(EQUAL, exit);
+    a.movzx8(RCX, RAX);
+    a.load(RDX, Mem{RDX, layout.native, RCX, 8}, W);
+    a.test64(RDX, RDX);
+    a.jcc(EQUAL, exit);
+    a.cmp16(Mem{RDX, (int32_t)offsetof(JitBlock, address)}, RAX);
+    a.jcc(NOT_EQUAL, exit);
+    a.jmp(Mem{RDX, (int32_t)offsetof(JitBlock, code)});
+
+    shared = used = (size_t)(a.at - cache + 15) & ~(size_t)15;
+    if (!writable(false)) {
+        munmap(cache, CODE_SIZE);
+        cache = nullptr;
+    }
+}
+
+Jit::~Jit() {
+    if (cache) {
+        cpu.blocks.drop_native();
+        munmap(cache, CODE_SIZE);
+    }
+}
+
+bool Jit::supported() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (ecx & 1);    // LAHF in 64 bit mode
+}
+
+bool Jit::writable(bool write) {
+    if (mprotect(cache, CODE_SIZE, write ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) != 0) {
+        spdlog::error("Em Jit::writable: mprotect falhou: {} |-> {}, line {}", std::strerror(errno), __FILE_NAME__, __LINE__);
+        return false;
+    }
+    return true;
+}
+
+bool Jit::run(uint64_t deadline) {
+    if (!cache) {
+        return false;
+    }
+    uint16_t pc = cpu.reg.pc;
+    BlockCache::PageBlocks& page = *cpu.blocks.page_of(pc);
+    JitBlock* block = page.native[pc & 0xFF];
+    if (!block) {
+        if (++page.runs[pc & 0xFF] < HOT_RUNS || !(block = translate(page, pc))) {
+            return false;
+        }
+    }
+    // Echo RAM shares blocks but not translations, and the first instruction of a block always runs
+    if (block->address != pc || (cpu.ime && cpu.bus.pending_interrupts())) {
+        return false;
+    }
+    cpu.reg.f.from_uint8(cpu.reg.f.to_uint8());
+    reinterpret_cast<void (*)(CPU*, uint64_t, const uint8_t*)>(enter)(&cpu, deadline, block->code);
+    return true;
+}
+
+void Jit::flush() {
+    cpu.blocks.drop_native();
+    translations.clear();
+    used = shared;
+}
+
+JitBlock* Jit::translate(BlockCache::PageBlocks& page, uint16_t address) {
+    const BlockCache::Instruction* instructions = &page.code[page.start[address & 0xFF]];
+    size_t count = 0;
+    while (instructions[count].handler) {
+        count++;
+    }
+    size_t needed = count * MAX_INSTRUCTION_CODE + 64;
+    if (used + needed > CODE_SIZE) {
+        flush();
+        if (used + needed > CODE_SIZE) {
+            page.runs[address & 0xFF] = 0;
+            return nullptr;
+        }
+    }
+
+    if (!writable(true)) {
+        page.runs[address & 0xFF] = 0;
+        return nullptr;
+    }
+    Assembler a{cache + used};
+    Translator translator{a, *layout, exit, dispatch, {}, {}};
+    translator.block(page, address, instructions);
+    if (!writable(false)) {
+        // Nothing can run from a cache stuck writable, leave everything to the block cache from now on
+        cpu.blocks.drop_native();
+        translations.clear();
+        munmap(cache, CODE_SIZE);
+        cache = nullptr;
+        return nullptr;
+    }
+    translations.push_back(JitBlock{cache + used, address});
+    used = (size_t)(a.at - cache + 15) & ~(size_t)15;
+    translated++;
+    page.native[address & 0xFF] = &translations.back();
+    return &translations.back();
+}
+
+#else
+
+struct Jit::Layout {};
+
+Jit::Jit(CPU& cpu) : cpu(cpu) {}
+Jit::~Jit() {}
+
+void Jit::find_layout() {}
+
+bool Jit::supported() {
+    return false;
+}
+
+bool Jit::run(uint64_t) {
+    return false;
+}
+
+bool Jit::writable(bool) {
+    return false;
+}
+
+void Jit::flush() {}
+
+JitBlock* Jit::translate(BlockCache::PageBlocks&, uint16_t) {
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,70 @@
+// Header file for the JIT
+// Optional x86-64 backend on top of the block cache (block_cache.h): blocks that keep getting replayed are translated
+// to native code. Inside it the guest registers live in host registers and memory goes through the bus page table
+// inline, only handler pages (I/O, mapper control, VRAM, pages with code in them) call back into the bus
+// Cycles are counted after every instruction and native code stops at the same instruction boundaries the block
+// cache would (deadline reached, interrupt can be taken, code or mapping changed under it), so the scheduler sees the
+// same thing. Blocks jump straight into the next one's native code while none of that happens
+// Opcodes it doesn't translate (DAA, HALT, STOP...) call their block cache handler
+// Built for x86-64 System V with MCGB_JIT and MCGB_BLOCK_CACHE, Jit::supported() tells if it can be used
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+#include "block_cache.h"
+
+struct CPU;
+
+// Native code of one block
+struct JitBlock {
+    const uint8_t* code;
+    uint16_t address;   // PC it was translated for, WRAM blocks are shared with the echo but PCs are baked in
+};
+
+struct Jit {
+    static constexpr uint16_t HOT_RUNS = 16;            // Block cache replays before a block gets translated
+    static constexpr size_t CODE_SIZE = 16 << 20;       // Code cache, dropped whole when it fills up, never
+                                                        // writable and executable at the same time
+
+    struct Layout;              // Offsets of the fields native code uses (jit.cpp)
+
+    CPU& cpu;
+    uint64_t translated = 0;    // Blocks translated so far, flushes included
+
+    explicit Jit(CPU& cpu);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Host and build can run the backend
+    static bool supported();
+    // supported() and the code cache could be allocated
+    bool usable() const { return cache != nullptr; }
+
+    // Called by CPU::run once the block cache found the block at PC. Runs it natively (and whatever it chains into)
+    // if it's hot, returns false when the caller should replay it itself
+    bool run(uint64_t deadline);
+    // Drops every translation
+    void flush();
+
+private:
+    uint8_t* cache = nullptr;
+    size_t used = 0;            // Bump allocator over `cache`
+    size_t shared = 0;          // Flag table and enter/exit/dispatch routines at the start, kept by flush()
+    const uint8_t* enter = nullptr;
+    const uint8_t* exit = nullptr;
+    const uint8_t* dispatch = nullptr;
+    std::deque<JitBlock> translations;  // Stable addresses, PageBlocks::native points in here
+    std::unique_ptr<Layout> layout;
+
+    void find_layout();
+    // Flips the code cache between read/write (while emitting) and read/execute
+    bool writable(bool write);
+    JitBlock* translate(BlockCache::PageBlocks& page, uint16_t address);
+};
+
+#endif
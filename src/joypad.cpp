@@ -0,0 +1,42 @@
+#include "joypad.h"
+
+namespace {
+
+uint8_t joypad_read(void* context, uint16_t) {
+    return static_cast<Joypad*>(context)->read();
+}
+
+// Only the two select bits can be written
+void joypad_write(void* context, uint16_t, uint8_t value) {
+    Bus& bus = static_cast<Joypad*>(context)->bus;
+    bus.high[0x00] = value & 0x30;
+}
+
+} // namespace
+
+Joypad::Joypad(Bus& bus) : bus(bus) {
+    bus.map_io(0xFF00, this, joypad_read, joypad_write);
+    bus.high[0x00] = 0x30;
+}
+
+void Joypad::set_button(Button button, bool down) {
+    uint8_t mask = (uint8_t)(1 << button);
+    bool was_down = pressed & mask;
+    pressed = down ? (pressed | mask) : (pressed & ~mask);
+    // The interrupt fires on a high to low edge of P10-P13, i.e. a press on a selected row
+    if (down && !was_down && (read() & (1 << (button & 3))) == 0) {
+        bus.request_interrupt(Interrupt::JOYPAD);
+    }
+}
+
+uint8_t Joypad::read() const {
+    uint8_t select = bus.high[0x00];
+    uint8_t low = 0x0F;
+    if (!(select & 0x10)) {
+        low &= ~(pressed & 0x0F);
+    }
+    if (!(select & 0x20)) {
+        low &= ~(pressed >> 4);
+    }
+    return (uint8_t)(0xC0 | select | low);
+}
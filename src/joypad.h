@@ -0,0 +1,35 @@
+// Header file for the Joypad (P1, 0xFF00)
+// The game selects the d-pad and/or the button row with bits 4-5 and reads the selected row in the low nibble,
+// a pressed button reads as 0
+#ifndef JOYPAD_H
+#define JOYPAD_H
+
+#include <cstdint>
+
+#include "bus.h"
+
+struct Joypad {
+    // Bit in `pressed`: d-pad in the low nibble, buttons in the high one, each in P1 bit order
+    enum Button : uint8_t {
+        RIGHT  = 0,
+        LEFT   = 1,
+        UP     = 2,
+        DOWN   = 3,
+        A      = 4,
+        B      = 5,
+        SELECT = 6,
+        START  = 7
+    };
+
+    Bus& bus;
+    uint8_t pressed = 0;
+
+    explicit Joypad(Bus& bus);
+    Joypad(const Joypad&) = delete;
+    Joypad& operator=(const Joypad&) = delete;
+
+    void set_button(Button button, bool down);
+    uint8_t read() const;
+};
+
+#endif
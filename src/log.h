@@ -0,0 +1,59 @@
+// Header file for the logging helpers
+// Log sites that can fire once per instruction (illegal opcodes...) go through the macros below instead of calling
+// spdlog directly:
+//   - They are compiled out when their level is below SPDLOG_ACTIVE_LEVEL (CMake option MCGB_LOG_LEVEL)
+//   - The runtime level is checked before anything is formatted
+//   - Each site logs at most LogRateLimit::BURST messages per second, the rest are only counted and reported as one
+//     line when the next second starts. A ROM stuck on a bad opcode can't flood the log queue or the disk
+#ifndef LOG_H
+#define LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <spdlog/spdlog.h>
+
+struct LogRateLimit {
+    static constexpr uint32_t BURST = 5;
+    static constexpr int64_t WINDOW_MS = 1000;
+
+    std::atomic<int64_t> window_start{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> suppressed{0};
+
+    // True when this message may be logged. Races between threads can let a message or two more through, that's fine
+    bool allow(spdlog::level::level_enum level) {
+        int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (now - window_start.load(std::memory_order_relaxed) >= WINDOW_MS) {
+            window_start.store(now, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            uint32_t dropped = suppressed.exchange(0, std::memory_order_relaxed);
+            if (dropped > 0) {
+                spdlog::log(level, "... {} mensagens repetidas suprimidas", dropped);
+            }
+        }
+        if (count.fetch_add(1, std::memory_order_relaxed) < BURST) {
+            return true;
+        }
+        suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+};
+
+// `severity` is the spdlog::level name (warn, err...), `LEVEL` the matching SPDLOG_LEVEL_ suffix (WARN, ERROR...)
+#define MCGB_LOG_LIMITED(severity, LEVEL, ...)                                                            \
+    do {                                                                                                  \
+        if (SPDLOG_LEVEL_##LEVEL >= SPDLOG_ACTIVE_LEVEL && spdlog::should_log(spdlog::level::severity)) { \
+            static LogRateLimit mcgb_rate_limit_;                                                         \
+            if (mcgb_rate_limit_.allow(spdlog::level::severity)) {                                        \
+                spdlog::log(spdlog::level::severity, __VA_ARGS__);                                        \
+            }                                                                                             \
+        }                                                                                                 \
+    } while (0)
+
+#define MCGB_WARN_LIMITED(...) MCGB_LOG_LIMITED(warn, WARN, __VA_ARGS__)
+#define MCGB_ERROR_LIMITED(...) MCGB_LOG_LIMITED(err, ERROR, __VA_ARGS__)
+
+#endif
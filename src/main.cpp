@@ -1,16 +1,81 @@
 #include <iostream>
 #include <filesystem>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h> // Essential for SDL3
+#include <spdlog/async.h>
 #include <spdlog/sinks/rotating_file_sink.h>
 
-#include "CPU.h"
+#include "audio_output.h"
+#include "display.h"
+#include "emulation_thread.h"
+#include "gameboy.h"
+#include "headless.h"
 
 
 
-const int WIDTH = 160 * 3;
-const int HEIGHT = 144 * 3;
+const int DEFAULT_SCALE = 3;
+const char* RUN_AHEAD_FILE = "run_ahead.txt";    // Next to the executable
+const size_t LOG_QUEUE_SIZE = 8192;     // Messages
+
+// Speed multiplier from the command line, 0 = uncapped
+unsigned parse_speed(const char* text) {
+    return (unsigned)std::min(std::max(std::atoi(text), 0), 64);
+}
+
+// Keyboard layout: arrows, Z = A, X = B, Enter = Start, Backspace = Select. Returns -1 for other keys
+int map_key(SDL_Keycode key) {
+    switch (key) {
+        case SDLK_RIGHT     : return Joypad::RIGHT;
+        case SDLK_LEFT      : return Joypad::LEFT;
+        case SDLK_UP        : return Joypad::UP;
+        case SDLK_DOWN      : return Joypad::DOWN;
+        case SDLK_Z         : return Joypad::A;
+        case SDLK_X         : return Joypad::B;
+        case SDLK_BACKSPACE : return Joypad::SELECT;
+        case SDLK_RETURN    : return Joypad::START;
+        default             : return -1;
+    }
+}
+
+// Run-ahead depends on how many frames of lag each game has, so it is kept per ROM: one "<frames> <rom file name>"
+// line per game in run_ahead.txt. The name goes last since ROM names usually have spaces in them
+std::filesystem::path run_ahead_path() {
+    const char* base = SDL_GetBasePath();
+    return std::filesystem::path(base ? base : "") / RUN_AHEAD_FILE;
+}
+
+std::map<std::string, unsigned> load_run_ahead_settings() {
+    std::map<std::string, unsigned> settings;
+    std::ifstream file(run_ahead_path());
+    std::string line;
+    while (std::getline(file, line)) {
+        // Lines that don't parse are skipped, the rest of the file still counts
+        std::istringstream fields(line);
+        unsigned frames = 0;
+        std::string name;
+        if (fields >> frames && fields.get() == ' ' && std::getline(fields, name) && !name.empty()) {
+            settings[name] = std::min(frames, EmulationThread::MAX_RUN_AHEAD);
+        }
+    }
+    return settings;
+}
+
+void save_run_ahead_settings(const std::map<std::string, unsigned>& settings) {
+    std::ofstream file(run_ahead_path());
+    for (const auto& [name, frames] : settings) {
+        file << frames << ' ' << name << '\n';
+    }
+}
 
 void setup_logger() {
     try {
@@ -21,9 +86,15 @@ void setup_logger() {
         auto file_sink = std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
             "logs/mcgb_emu.log", 10 * 1024 * 1024, 3, false);
         
-        auto logger = std::make_shared<spdlog::logger>("global_logger", file_sink);
+        // Asynchronous: the emulation thread only formats and queues a message, a background thread writes it
+        // The queue is bounded, when it is full the oldest message is dropped so logging never blocks the emulation
+        spdlog::init_thread_pool(LOG_QUEUE_SIZE, 1);
+        auto logger = std::make_shared<spdlog::async_logger>("global_logger", file_sink, spdlog::thread_pool(),
+                                                             spdlog::async_overflow_policy::overrun_oldest);
         spdlog::set_default_logger(logger);
-        spdlog::flush_on(spdlog::level::info);
+        // Warnings and errors go to disk right away, the rest at least once a second
+        spdlog::flush_on(spdlog::level::warn);
+        spdlog::flush_every(std::chrono::seconds(1));
     } catch (const spdlog::spdlog_ex& ex) {
         std::cout << "Falha na inicializacao do Log: " << ex.what() << std::endl;
     }
@@ -35,32 +106,98 @@ int main(int argc, char* argv[]) {
     spdlog::set_pattern("[%Y-%m-%d %H:%M:%S.%e] [%l] %v");
     
     spdlog::info("McGB Emulator was launch ______________________________________________________________________________________________________________");
+
+    // --headless runs the ROM without ever touching SDL (see headless.h for the options)
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--headless") == 0) {
+            HeadlessOptions options;
+            if (!parse_headless_args(argc, argv, options)) {
+                print_headless_usage(argv[0]);
+                return HeadlessExit::ERROR;
+            }
+            int code = headless_main(options);
+            spdlog::shutdown();
+            return code;
+        }
+    }
+
+    // The ROM path comes from the command line (launch.sh forwards its arguments), e.g. ./launch.sh tetris.gb
+    // --scale N sets the starting window size, the picture is always scaled by a whole factor to fit the window
+    // --speed N starts at N times real time (0 = uncapped), --fast-forward N is the speed while Tab is held
+    // (uncapped by default), --render-all draws every frame even when most of them won't be shown
+    // --rewind N keeps N seconds of history for rewinding (60 by default, 0 turns it off)
+    // --run-ahead N (0-3) sets this ROM's run-ahead, it is remembered for the next time
+    const char* rom_path = nullptr;
+    int scale = DEFAULT_SCALE;
+    unsigned speed = 1;
+    unsigned fast_forward_speed = 0;
+    bool render_all = false;
+    unsigned rewind_seconds = 60;
+    int run_ahead_arg = -1;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = parse_speed(argv[++i]);
+        } else if (std::strcmp(argv[i], "--fast-forward") == 0 && i + 1 < argc) {
+            fast_forward_speed = parse_speed(argv[++i]);
+        } else if (std::strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewind_seconds = (unsigned)std::min(std::max(std::atoi(argv[++i]), 0), 600);
+        } else if (std::strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+            run_ahead_arg = std::min(std::max(std::atoi(argv[++i]), 0), (int)EmulationThread::MAX_RUN_AHEAD);
+        } else if (std::strcmp(argv[i], "--render-all") == 0) {
+            render_all = true;
+        } else if (!rom_path) {
+            rom_path = argv[i];
+        }
+    }
+
+    auto gameboy = std::make_unique<GameBoy>();
+    if (rom_path && !gameboy->insert_cartridge(rom_path)) {
+        std::cout << "Failed to load ROM: " << rom_path << std::endl;
+        return 1;
+    }
     
     // 1. Start SDL
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
         std::cout << "SDL failed to start: " << SDL_GetError() << std::endl;
         return 1;
     }
 
-    // 2. Create Window
+    // 2. Create Window, Renderer and the screen texture
     spdlog::info("SDL inicializado com sucesso. Criando a janela...");
-    SDL_Window* window = SDL_CreateWindow("McGB Window Test", WIDTH, HEIGHT, 0);
-    if (!window) {
+    auto display = std::make_unique<Display>();
+    if (!display->create("McGB", scale)) {
         std::cout << "Window failed to open: " << SDL_GetError() << std::endl;
-        spdlog::critical("Falha ao criar a janela: {}", SDL_GetError());
         return 1;
     }
 
-    // 3. Create Renderer
-    spdlog::info("Janela criada com sucesso. Criando o renderer...");
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, nullptr);
-    if (!renderer) {
-        std::cout << "Renderer failed: " << SDL_GetError() << std::endl;
-        spdlog::critical("Falha ao criar o renderer: {}", SDL_GetError());
-        return 1;
+    // No sound device is not a reason to stop, the game just runs silent
+    auto audio = std::make_unique<AudioOutput>();
+    bool has_audio = audio->open();
+
+    // 3. Emulation gets its own thread, this one keeps the window: events in, finished frames out
+    auto emulation = std::make_unique<EmulationThread>(*gameboy);
+    emulation->audio = has_audio ? &audio->ring : nullptr;
+    emulation->speed = speed;
+    emulation->skip_hidden_frames = !render_all;
+    emulation->rewind_seconds = rewind_seconds;
+    std::map<std::string, unsigned> run_ahead_settings = load_run_ahead_settings();
+    std::string rom_name;
+    if (rom_path) {
+        emulation->state_path = std::filesystem::path(rom_path).replace_extension(".state").string();
+        rom_name = std::filesystem::path(rom_path).filename().string();
+        if (run_ahead_arg >= 0) {
+            run_ahead_settings[rom_name] = (unsigned)run_ahead_arg;
+            save_run_ahead_settings(run_ahead_settings);
+        }
+        emulation->run_ahead = run_ahead_settings.count(rom_name) ? run_ahead_settings[rom_name] : 0;
     }
+    unsigned run_ahead = emulation->run_ahead;
+    emulation->start();
 
     bool running = true;
+    bool fast_forward_held = false;
     SDL_Event event;
 
     // 4. The Loop
@@ -68,18 +205,65 @@ int main(int argc, char* argv[]) {
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) {
                 running = false;
+            } else if ((event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP) && !event.key.repeat) {
+                // Tab held: fast-forward. F1: cycle the turbo speed 1x -> 2x -> 4x -> 8x -> uncapped -> 1x
+                if (event.key.key == SDLK_TAB) {
+                    fast_forward_held = event.key.down;
+                    uint8_t value = (uint8_t)(fast_forward_held ? fast_forward_speed : speed);
+                    emulation->send(Command{Command::Type::set_speed, value});
+                    continue;
+                }
+                if (event.key.key == SDLK_F1) {
+                    if (event.key.down) {
+                        speed = speed == 0 ? 1 : (speed >= 8 ? 0 : speed * 2);
+                        if (!fast_forward_held) {
+                            emulation->send(Command{Command::Type::set_speed, (uint8_t)speed});
+                        }
+                    }
+                    continue;
+                }
+                // F2: cycle this ROM's run-ahead 0 -> 1 -> 2 -> 3 -> 0 frames
+                if (event.key.key == SDLK_F2) {
+                    if (event.key.down && rom_path) {
+                        run_ahead = (run_ahead + 1) % (EmulationThread::MAX_RUN_AHEAD + 1);
+                        emulation->send(Command{Command::Type::set_run_ahead, (uint8_t)run_ahead});
+                        run_ahead_settings[rom_name] = run_ahead;
+                        save_run_ahead_settings(run_ahead_settings);
+                    }
+                    continue;
+                }
+                // R held: rewind
+                if (event.key.key == SDLK_R) {
+                    emulation->send(Command{Command::Type::rewind, (uint8_t)event.key.down});
+                    continue;
+                }
+                // F5 saves the machine next to the ROM (rom.state), F8 loads it back
+                if (event.key.key == SDLK_F5 || event.key.key == SDLK_F8) {
+                    if (event.key.down && rom_path) {
+                        bool save = event.key.key == SDLK_F5;
+                        emulation->send(Command{save ? Command::Type::save_state : Command::Type::load_state, 0});
+                    }
+                    continue;
+                }
+                int button = map_key(event.key.key);
+                if (button >= 0) {
+                    Command::Type type = event.key.down ? Command::Type::button_down : Command::Type::button_up;
+                    emulation->send(Command{type, (uint8_t)button});
+                }
             }
         }
-        SDL_RenderClear(renderer);
-        SDL_RenderPresent(renderer);
+        if (emulation->frames.update()) {
+            display->present(emulation->frames.read_buffer().data());
+        } else {
+            // Nothing new yet, don't spin (a frame is ~16.7ms, this keeps the added latency under 1ms)
+            SDL_DelayNS(1000000);
+        }
     }
 
-    CPU A;
-    A.execute(Instruction::InstructionWithImmediate(InstructionType::DEC,23));
-
     // 5. Cleanup
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    emulation->stop();
+    audio.reset();
+    display.reset();
     SDL_Quit();
 
     spdlog::info("McGB Emulator was shutdown ____________________________________________________________________________________________________________\n");
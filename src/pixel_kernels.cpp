@@ -0,0 +1,261 @@
+#include "pixel_kernels.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MCGB_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace PixelKernels {
+
+namespace {
+
+// Scalar
+
+void decode_tile_scalar(const uint8_t* data, uint8_t* pixels) {
+    for (int row = 0; row < 8; row++) {
+        uint8_t low = data[row * 2];
+        uint8_t high = data[row * 2 + 1];
+        for (int x = 0; x < 8; x++) {
+            int bit = 7 - x;
+            pixels[row * 8 + x] = (uint8_t)((((high >> bit) & 1) << 1) | ((low >> bit) & 1));
+        }
+    }
+}
+
+void map_shades_scalar(const uint8_t* indices, uint8_t* shades, size_t count, uint8_t palette) {
+    for (size_t i = 0; i < count; i++) {
+        shades[i] = (palette >> (indices[i] * 2)) & 0x03;
+    }
+}
+
+void map_rgba_scalar(const uint8_t* shades, uint32_t* pixels, size_t count, const uint32_t colors[4]) {
+    for (size_t i = 0; i < count; i++) {
+        pixels[i] = colors[shades[i]];
+    }
+}
+
+#ifdef MCGB_X86_KERNELS
+
+// SSE2, 16 pixels (two tile rows) per register
+// A row's low and high bytes are each repeated 8 times, tested against one bit per byte (0x80 for the leftmost pixel)
+// and the two masks merged into 0-3
+
+__attribute__((target("sse2")))
+inline __m128i combine_planes_sse2(__m128i low, __m128i high) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+    __m128i low_set = _mm_cmpeq_epi8(_mm_and_si128(low, bits), bits);
+    __m128i high_set = _mm_cmpeq_epi8(_mm_and_si128(high, bits), bits);
+    return _mm_or_si128(_mm_and_si128(low_set, _mm_set1_epi8(1)), _mm_and_si128(high_set, _mm_set1_epi8(2)));
+}
+
+// `pairs` holds low/high bytes of 4 rows each repeated twice (l0 l0 h0 h0 l1 l1 h1 h1 ...), writes rows 0-3
+__attribute__((target("sse2")))
+inline void decode_four_rows_sse2(__m128i pairs, uint8_t* pixels) {
+    __m128i rows01 = _mm_unpacklo_epi16(pairs, pairs);     // l0 x4 h0 x4 l1 x4 h1 x4
+    __m128i rows23 = _mm_unpackhi_epi16(pairs, pairs);
+    __m128i row0 = _mm_unpacklo_epi32(rows01, rows01);      // l0 x8 h0 x8
+    __m128i row1 = _mm_unpackhi_epi32(rows01, rows01);
+    __m128i row2 = _mm_unpacklo_epi32(rows23, rows23);
+    __m128i row3 = _mm_unpackhi_epi32(rows23, rows23);
+    _mm_storeu_si128((__m128i*)pixels,
+                     combine_planes_sse2(_mm_unpacklo_epi64(row0, row1), _mm_unpackhi_epi64(row0, row1)));
+    _mm_storeu_si128((__m128i*)(pixels + 16),
+                     combine_planes_sse2(_mm_unpacklo_epi64(row2, row3), _mm_unpackhi_epi64(row2, row3)));
+}
+
+__attribute__((target("sse2")))
+void decode_tile_sse2(const uint8_t* data, uint8_t* pixels) {
+    __m128i tile = _mm_loadu_si128((const __m128i*)data);
+    decode_four_rows_sse2(_mm_unpacklo_epi8(tile, tile), pixels);
+    decode_four_rows_sse2(_mm_unpackhi_epi8(tile, tile), pixels + 32);
+}
+
+// No byte shuffle in SSE2, so the 4 entry lookup is a select on index == 0..3
+__attribute__((target("sse2")))
+void map_shades_sse2(const uint8_t* indices, uint8_t* shades, size_t count, uint8_t palette) {
+    __m128i entries[4];
+    for (int i = 0; i < 4; i++) {
+        entries[i] = _mm_set1_epi8((char)((palette >> (i * 2)) & 0x03));
+    }
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index = _mm_loadu_si128((const __m128i*)(indices + i));
+        __m128i result = _mm_setzero_si128();
+        for (int value = 1; value < 4; value++) {
+            __m128i match = _mm_cmpeq_epi8(index, _mm_set1_epi8((char)value));
+            result = _mm_or_si128(result, _mm_and_si128(match, entries[value]));
+        }
+        __m128i zero = _mm_cmpeq_epi8(index, _mm_setzero_si128());
+        result = _mm_or_si128(result, _mm_and_si128(zero, entries[0]));
+        _mm_storeu_si128((__m128i*)(shades + i), result);
+    }
+    map_shades_scalar(indices + i, shades + i, count - i, palette);
+}
+
+__attribute__((target("sse2")))
+inline __m128i select_sse2(__m128i mask, __m128i if_set, __m128i if_clear) {
+    return _mm_or_si128(_mm_and_si128(mask, if_set), _mm_andnot_si128(mask, if_clear));
+}
+
+__attribute__((target("sse2")))
+inline void store_rgba_sse2(uint32_t* out, __m128i bit0, __m128i bit1,
+                            __m128i color0, __m128i color1, __m128i color2, __m128i color3) {
+    __m128i result = select_sse2(bit1, select_sse2(bit0, color3, color2), select_sse2(bit0, color1, color0));
+    _mm_storeu_si128((__m128i*)out, result);
+}
+
+// Each shade is picked with two selects on its bits, the byte masks are widened to 32 bits by unpacking them with
+// themselves (0xFF -> 0xFFFF -> 0xFFFFFFFF)
+__attribute__((target("sse2")))
+void map_rgba_sse2(const uint8_t* shades, uint32_t* pixels, size_t count, const uint32_t colors[4]) {
+    const __m128i color0 = _mm_set1_epi32((int)colors[0]);
+    const __m128i color1 = _mm_set1_epi32((int)colors[1]);
+    const __m128i color2 = _mm_set1_epi32((int)colors[2]);
+    const __m128i color3 = _mm_set1_epi32((int)colors[3]);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(shades + i));
+        __m128i bit0 = _mm_cmpeq_epi8(_mm_and_si128(bytes, one), one);
+        __m128i bit1 = _mm_cmpeq_epi8(_mm_and_si128(bytes, two), two);
+        __m128i bit0_low = _mm_unpacklo_epi8(bit0, bit0);
+        __m128i bit0_high = _mm_unpackhi_epi8(bit0, bit0);
+        __m128i bit1_low = _mm_unpacklo_epi8(bit1, bit1);
+        __m128i bit1_high = _mm_unpackhi_epi8(bit1, bit1);
+        uint32_t* out = pixels + i;
+        store_rgba_sse2(out, _mm_unpacklo_epi16(bit0_low, bit0_low), _mm_unpacklo_epi16(bit1_low, bit1_low),
+                        color0, color1, color2, color3);
+        store_rgba_sse2(out + 4, _mm_unpackhi_epi16(bit0_low, bit0_low), _mm_unpackhi_epi16(bit1_low, bit1_low),
+                        color0, color1, color2, color3);
+        store_rgba_sse2(out + 8, _mm_unpacklo_epi16(bit0_high, bit0_high), _mm_unpacklo_epi16(bit1_high, bit1_high),
+                        color0, color1, color2, color3);
+        store_rgba_sse2(out + 12, _mm_unpackhi_epi16(bit0_high, bit0_high), _mm_unpackhi_epi16(bit1_high, bit1_high),
+                        color0, color1, color2, color3);
+    }
+    map_rgba_scalar(shades + i, pixels + i, count - i, colors);
+}
+
+// AVX2, 32 pixels (four tile rows) per register, with byte shuffles doing the repeats and the palette lookups
+
+__attribute__((target("avx2")))
+void decode_tile_avx2(const uint8_t* data, uint8_t* pixels) {
+    const __m256i tile = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)data));
+    const __m256i bits = _mm256_set1_epi64x((long long)0x0102040810204080ull);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    // Rows 0-1 (or 4-5) come from the low lane, rows 2-3 (6-7) from the high lane, both lanes hold the whole tile
+    const __m256i low_rows[2] = {
+        _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2,
+                         4, 4, 4, 4, 4, 4, 4, 4, 6, 6, 6, 6, 6, 6, 6, 6),
+        _mm256_setr_epi8(8, 8, 8, 8, 8, 8, 8, 8, 10, 10, 10, 10, 10, 10, 10, 10,
+                         12, 12, 12, 12, 12, 12, 12, 12, 14, 14, 14, 14, 14, 14, 14, 14),
+    };
+    for (int half = 0; half < 2; half++) {
+        __m256i low = _mm256_shuffle_epi8(tile, low_rows[half]);
+        __m256i high = _mm256_shuffle_epi8(tile, _mm256_add_epi8(low_rows[half], one));
+        __m256i low_set = _mm256_cmpeq_epi8(_mm256_and_si256(low, bits), bits);
+        __m256i high_set = _mm256_cmpeq_epi8(_mm256_and_si256(high, bits), bits);
+        __m256i result = _mm256_or_si256(_mm256_and_si256(low_set, one), _mm256_and_si256(high_set, two));
+        _mm256_storeu_si256((__m256i*)(pixels + half * 32), result);
+    }
+}
+
+__attribute__((target("avx2")))
+void map_shades_avx2(const uint8_t* indices, uint8_t* shades, size_t count, uint8_t palette) {
+    // Only entries 0-3 of the table are ever picked
+    const __m256i table = _mm256_setr_epi8(
+        (char)(palette & 3), (char)((palette >> 2) & 3), (char)((palette >> 4) & 3), (char)(palette >> 6),
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        (char)(palette & 3), (char)((palette >> 2) & 3), (char)((palette >> 4) & 3), (char)(palette >> 6),
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i index = _mm256_loadu_si256((const __m256i*)(indices + i));
+        _mm256_storeu_si256((__m256i*)(shades + i), _mm256_shuffle_epi8(table, index));
+    }
+    map_shades_scalar(indices + i, shades + i, count - i, palette);
+}
+
+__attribute__((target("avx2")))
+void map_rgba_avx2(const uint8_t* shades, uint32_t* pixels, size_t count, const uint32_t colors[4]) {
+    const __m256i table = _mm256_setr_epi32((int)colors[0], (int)colors[1], (int)colors[2], (int)colors[3],
+                                            (int)colors[0], (int)colors[1], (int)colors[2], (int)colors[3]);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(shades + i)));
+        _mm256_storeu_si256((__m256i*)(pixels + i), _mm256_permutevar8x32_epi32(table, index));
+    }
+    map_rgba_scalar(shades + i, pixels + i, count - i, colors);
+}
+
+#endif
+
+const Table scalar_table = {Level::scalar, decode_tile_scalar, map_shades_scalar, map_rgba_scalar};
+#ifdef MCGB_X86_KERNELS
+const Table sse2_table = {Level::sse2, decode_tile_sse2, map_shades_sse2, map_rgba_sse2};
+const Table avx2_table = {Level::avx2, decode_tile_avx2, map_shades_avx2, map_rgba_avx2};
+#endif
+
+const Table& choose() {
+    Level best = Level::scalar;
+    if (supported(Level::avx2)) {
+        best = Level::avx2;
+    } else if (supported(Level::sse2)) {
+        best = Level::sse2;
+    }
+    if (const char* forced = std::getenv("MCGB_SIMD")) {
+        for (Level level : {Level::scalar, Level::sse2, Level::avx2}) {
+            if (std::strcmp(forced, name(level)) == 0 && supported(level)) {
+                best = level;
+            }
+        }
+    }
+    return table(best);
+}
+
+} // namespace
+
+const char* name(Level level) {
+    switch (level) {
+        case Level::scalar : return "scalar";
+        case Level::sse2   : return "sse2";
+        case Level::avx2   : return "avx2";
+    }
+    return "?";
+}
+
+bool supported(Level level) {
+    switch (level) {
+        case Level::scalar : return true;
+#ifdef MCGB_X86_KERNELS
+        case Level::sse2   : return __builtin_cpu_supports("sse2");
+        case Level::avx2   : return __builtin_cpu_supports("avx2");
+#endif
+        default            : return false;
+    }
+}
+
+const Table& table(Level level) {
+#ifdef MCGB_X86_KERNELS
+    if (level == Level::avx2 && supported(level)) {
+        return avx2_table;
+    }
+    if (level == Level::sse2 && supported(level)) {
+        return sse2_table;
+    }
+#endif
+    (void)level;
+    return scalar_table;
+}
+
+const Table& active() {
+    static const Table& chosen = choose();
+    return chosen;
+}
+
+}
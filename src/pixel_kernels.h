@@ -0,0 +1,36 @@
+// Header file for the pixel kernels
+// The two inner loops of rendering: decoding 2bpp tile rows into color indices and mapping indices through a
+// palette (into shades for the framebuffer, or into RGBA for the screen texture)
+// Each has a scalar, an SSE2 and an AVX2 version; the best one the host CPU supports is picked at runtime (GCC/Clang on
+// x86, everything else gets the scalar one). All versions give bit-identical output
+// Set MCGB_SIMD=scalar|sse2|avx2 in the environment to force a level, e.g. to compare them
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace PixelKernels {
+
+enum class Level { scalar, sse2, avx2 };
+
+struct Table {
+    Level level;
+    // 16 bytes of tile data (8 rows, low bitplane first) into 64 color indices (0-3), row by row
+    void (*decode_tile)(const uint8_t* data, uint8_t* pixels);
+    // Color indices (0-3) into shades through a DMG palette register (BGP/OBP0/OBP1)
+    void (*map_shades)(const uint8_t* indices, uint8_t* shades, size_t count, uint8_t palette);
+    // Shades (0-3) into 32 bit pixels
+    void (*map_rgba)(const uint8_t* shades, uint32_t* pixels, size_t count, const uint32_t colors[4]);
+};
+
+const char* name(Level level);
+bool supported(Level level);
+// Kernels of one level (the scalar ones if the host can't run it)
+const Table& table(Level level);
+// Kernels used by the emulator, chosen on the first call
+const Table& active();
+
+}
+
+#endif
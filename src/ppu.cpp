@@ -0,0 +1,314 @@
+#include "ppu.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+void ppu_mode_change(void* context, uint64_t time) {
+    static_cast<PPU*>(context)->mode_change(time);
+}
+
+void ppu_dma_done(void* context, uint64_t time) {
+    static_cast<PPU*>(context)->dma_done(time);
+}
+
+void lcdc_write(void* context, uint16_t, uint8_t value) {
+    static_cast<PPU*>(context)->write_lcdc(value);
+}
+
+void stat_write(void* context, uint16_t, uint8_t value) {
+    static_cast<PPU*>(context)->write_stat(value);
+}
+
+void lyc_write(void* context, uint16_t, uint8_t value) {
+    static_cast<PPU*>(context)->write_lyc(value);
+}
+
+void dma_write(void* context, uint16_t, uint8_t value) {
+    static_cast<PPU*>(context)->write_dma(value);
+}
+
+// Tile data (0x8000-0x97FF) is read straight from VRAM, writes come through here to keep the tile cache honest
+uint8_t vram_read(void* context, uint16_t address) {
+    return static_cast<PPU*>(context)->bus.vram[address & 0x1FFF];
+}
+
+void vram_tile_write(void* context, uint16_t address, uint8_t value) {
+    static_cast<PPU*>(context)->write_vram_tile(address, value);
+}
+
+// Tile number in a BG/window map to tile cache index: 0x8000 addressing is unsigned, 0x8800 is signed from 0x9000
+int bg_tile_index(uint8_t id, uint8_t lcdc) {
+    return (lcdc & 0x10) ? id : 256 + (int8_t)id;
+}
+
+// Copies `count` pixels of one row of a 32x32 tile map into `indices`, starting `map_x` pixels into the map
+void render_map_row(PPU& ppu, const uint8_t* map_row, int tile_row, int map_x, uint8_t* indices, int count) {
+    uint8_t lcdc = ppu.bus.high[PPU::LCDC];
+    while (count > 0) {
+        const uint8_t* pixels = ppu.tile(bg_tile_index(map_row[(map_x >> 3) & 31], lcdc)) + tile_row * 8;
+        int start = map_x & 7;
+        int run = std::min(8 - start, count);
+        std::memcpy(indices, pixels + start, run);
+        indices += run;
+        map_x += run;
+        count -= run;
+    }
+}
+
+// LY is read only
+void ignore_write(void*, uint16_t, uint8_t) {}
+
+uint8_t ly_read(void* context, uint16_t) {
+    const PPU& ppu = *static_cast<PPU*>(context);
+    return ppu.doctor_ly ? 0x90 : ppu.bus.high[PPU::LY];
+}
+
+// Bit 7 of STAT doesn't exist and reads as 1
+uint8_t stat_read(void* context, uint16_t) {
+    return static_cast<PPU*>(context)->bus.high[PPU::STAT] | 0x80;
+}
+
+} // namespace
+
+PPU::PPU(Bus& bus, Scheduler& scheduler) : bus(bus), scheduler(scheduler) {
+    bus.map_io(0xFF40, this, nullptr, lcdc_write);
+    bus.map_io(0xFF41, this, stat_read, stat_write);
+    bus.map_io(0xFF44, this, ly_read, ignore_write);
+    bus.map_io(0xFF45, this, nullptr, lyc_write);
+    bus.map_io(0xFF46, this, nullptr, dma_write);
+    bus.map(0x80, 0x18, bus.vram.data(), nullptr);
+    bus.set_handlers(0x80, 0x18, this, vram_read, vram_tile_write);
+    scheduler.set_callback(Event::ppu_mode, this, ppu_mode_change);
+    scheduler.set_callback(Event::oam_dma, this, ppu_dma_done);
+
+    invalidate_tiles();
+
+    // Values the boot ROM leaves behind
+    bus.high[LCDC] = 0x91;
+    bus.high[BGP] = 0xFC;
+    set_ly(0);
+    enter_mode(OAM_SCAN, scheduler.now());
+}
+
+void PPU::enter_mode(Mode new_mode, uint64_t time) {
+    mode = new_mode;
+    uint32_t duration = 0;
+    switch (mode) {
+        case OAM_SCAN : duration = OAM_SCAN_CYCLES; break;
+        case DRAWING  : duration = DRAWING_CYCLES; break;
+        case HBLANK   : duration = LINE_CYCLES - OAM_SCAN_CYCLES - DRAWING_CYCLES; break;
+        case VBLANK   : duration = LINE_CYCLES; break;
+    }
+    scheduler.schedule(Event::ppu_mode, time + duration);
+    update_stat();
+}
+
+void PPU::mode_change(uint64_t time) {
+    switch (mode) {
+        case OAM_SCAN : {
+            enter_mode(DRAWING, time);
+            break;
+        }
+        case DRAWING : {
+            if (!skip_render) {
+                render_line();
+            }
+            enter_mode(HBLANK, time);
+            break;
+        }
+        case HBLANK : {
+            set_ly(ly + 1);
+            if (ly == SCREEN_HEIGHT) {
+                frame_ready = true;
+                frames++;
+                bus.request_interrupt(Interrupt::VBLANK);
+                enter_mode(VBLANK, time);
+            } else {
+                enter_mode(OAM_SCAN, time);
+            }
+            break;
+        }
+        case VBLANK : {
+            if (ly == LINES - 1) {
+                window_triggered = false;
+                window_line = 0;
+                set_ly(0);
+                enter_mode(OAM_SCAN, time);
+            } else {
+                set_ly(ly + 1);
+                enter_mode(VBLANK, time);
+            }
+            break;
+        }
+    }
+}
+
+void PPU::set_ly(uint8_t line) {
+    ly = line;
+    bus.high[LY] = line;
+}
+
+// Refreshes the mode/coincidence bits of STAT and raises the STAT interrupt on a rising edge of its sources
+void PPU::update_stat() {
+    uint8_t stat = bus.high[STAT] & 0x78;
+    bool coincidence = ly == bus.high[LYC];
+    stat |= (coincidence ? 0x04 : 0) | mode;
+    bus.high[STAT] = stat;
+
+    bool line = false;
+    if (lcd_enabled()) {
+        line = (coincidence && (stat & 0x40)) ||
+               (mode == HBLANK && (stat & 0x08)) ||
+               (mode == VBLANK && (stat & 0x10)) ||
+               (mode == OAM_SCAN && (stat & 0x20));
+    }
+    if (line && !stat_line) {
+        bus.request_interrupt(Interrupt::LCD_STAT);
+    }
+    stat_line = line;
+}
+
+void PPU::write_lcdc(uint8_t value) {
+    bool was_enabled = lcd_enabled();
+    bus.high[LCDC] = value;
+    if (was_enabled && !lcd_enabled()) {
+        // LCD off: LY sticks at 0 in HBlank and nothing is scheduled until it comes back on
+        scheduler.cancel(Event::ppu_mode);
+        set_ly(0);
+        mode = HBLANK;
+        update_stat();
+        framebuffer.fill(0);
+    } else if (!was_enabled && lcd_enabled()) {
+        window_triggered = false;
+        window_line = 0;
+        set_ly(0);
+        enter_mode(OAM_SCAN, scheduler.now());
+    }
+}
+
+void PPU::write_vram_tile(uint16_t address, uint8_t value) {
+    uint16_t offset = address & 0x1FFF;
+    if (bus.vram[offset] != value) {
+        bus.vram[offset] = value;
+        tile_dirty[offset >> 4] = true;
+    }
+}
+
+void PPU::write_stat(uint8_t value) {
+    bus.high[STAT] = (value & 0x78) | (bus.high[STAT] & 0x07);
+    update_stat();
+}
+
+void PPU::write_lyc(uint8_t value) {
+    bus.high[LYC] = value;
+    update_stat();
+}
+
+void PPU::write_dma(uint8_t value) {
+    bus.high[DMA] = value;
+    scheduler.schedule(Event::oam_dma, scheduler.now() + DMA_CYCLES);
+}
+
+// The transfer is done in one go when it completes, games sit in HRAM waiting for it anyway
+void PPU::dma_done(uint64_t) {
+    uint16_t source = (uint16_t)(bus.high[DMA] << 8);
+    for (uint16_t i = 0; i < 0xA0; i++) {
+        bus.oam[i] = bus.read_memory(source + i);
+    }
+}
+
+// 2bpp: each row is two bytes, the first holds bit 0 of the 8 pixels and the second bit 1, leftmost pixel in bit 7
+void PPU::decode_tile(int index) {
+    kernels.decode_tile(&bus.vram[index * 16], tiles[index].data());
+    tile_dirty[index] = false;
+}
+
+void PPU::render_line() {
+    uint8_t lcdc = bus.high[LCDC];
+    std::array<uint8_t, SCREEN_WIDTH> indices{};    // BG/window color indices, before the palette
+    if (ly == bus.high[WY]) {
+        window_triggered = true;
+    }
+    // On DMG, LCDC bit 0 off blanks both background and window
+    if (lcdc & 0x01) {
+        render_background(indices.data());
+        if (lcdc & 0x20) {
+            render_window(indices.data());
+        }
+    }
+
+    uint8_t* line = &framebuffer[ly * SCREEN_WIDTH];
+    kernels.map_shades(indices.data(), line, SCREEN_WIDTH, bus.high[BGP]);
+    if (lcdc & 0x02) {
+        render_sprites(indices.data(), line);
+    }
+}
+
+void PPU::render_background(uint8_t* indices) {
+    uint16_t map = (bus.high[LCDC] & 0x08) ? 0x1C00 : 0x1800;
+    uint8_t y = (uint8_t)(ly + bus.high[SCY]);
+    render_map_row(*this, &bus.vram[map + (y >> 3) * 32], y & 7, bus.high[SCX], indices, SCREEN_WIDTH);
+}
+
+void PPU::render_window(uint8_t* indices) {
+    int window_x = bus.high[WX] - 7;
+    if (!window_triggered || window_x >= SCREEN_WIDTH) {
+        return;
+    }
+    uint16_t map = (bus.high[LCDC] & 0x40) ? 0x1C00 : 0x1800;
+    int first = std::max(window_x, 0);
+    render_map_row(*this, &bus.vram[map + (window_line >> 3) * 32], window_line & 7, first - window_x,
+                   indices + first, SCREEN_WIDTH - first);
+    window_line++;
+}
+
+void PPU::render_sprites(const uint8_t* bg_indices, uint8_t* line) {
+    int height = (bus.high[LCDC] & 0x04) ? 16 : 8;
+
+    // OAM scan: the first 10 sprites in OAM order that cover this line
+    int selected[SPRITES_PER_LINE];
+    int count = 0;
+    for (int i = 0; i < 40 && count < SPRITES_PER_LINE; i++) {
+        int y = bus.oam[i * 4] - 16;
+        if (ly >= y && ly < y + height) {
+            selected[count++] = i;
+        }
+    }
+    // DMG priority: the sprite with the smaller X wins, OAM order breaks ties
+    std::stable_sort(selected, selected + count, [this](int a, int b) {
+        return bus.oam[a * 4 + 1] < bus.oam[b * 4 + 1];
+    });
+
+    // The highest priority opaque sprite pixel owns the dot even when it ends up hidden behind the background
+    bool taken[SCREEN_WIDTH] = {};
+    for (int i = 0; i < count; i++) {
+        const uint8_t* sprite = &bus.oam[selected[i] * 4];
+        int x = sprite[1] - 8;
+        uint8_t attributes = sprite[3];
+        int row = ly - (sprite[0] - 16);
+        if (attributes & 0x40) {
+            row = height - 1 - row;
+        }
+        int index = height == 16 ? (sprite[2] & 0xFE) + (row >> 3) : sprite[2];
+        const uint8_t* pixels = tile(index) + (row & 7) * 8;
+        uint8_t palette = bus.high[(attributes & 0x10) ? OBP1 : OBP0];
+
+        for (int px = 0; px < 8; px++) {
+            int screen_x = x + px;
+            if (screen_x < 0 || screen_x >= SCREEN_WIDTH || taken[screen_x]) {
+                continue;
+            }
+            uint8_t color = pixels[(attributes & 0x20) ? 7 - px : px];
+            if (color == 0) {
+                continue;
+            }
+            taken[screen_x] = true;
+            if ((attributes & 0x80) && bg_indices[screen_x] != 0) {
+                continue;
+            }
+            line[screen_x] = (palette >> (color * 2)) & 0x03;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+// Header file for the PPU component
+// LCD timing: every mode change (OAM scan -> drawing -> HBlank, VBlank lines) is a scheduler event, the PPU is never
+// ticked per cycle. Also owns OAM DMA (0xFF46) since it only ever targets OAM
+// Rendering is done a whole scanline at a time when the line enters HBlank: background, window, then up to 10
+// sprites. Tiles are read from a cache of the 384 tiles already decoded from 2bpp, a tile is decoded again only
+// after the bus sees a write into its 16 bytes
+// The LCD registers (0xFF40-0xFF4B) live in bus.high, the PPU hooks the ones with side effects
+#ifndef PPU_H
+#define PPU_H
+
+#include <array>
+#include <cstdint>
+
+#include "bus.h"
+#include "pixel_kernels.h"
+#include "scheduler.h"
+
+struct PPU {
+    enum Mode : uint8_t {
+        HBLANK   = 0,
+        VBLANK   = 1,
+        OAM_SCAN = 2,
+        DRAWING  = 3
+    };
+
+    static constexpr int SCREEN_WIDTH = 160;
+    static constexpr int SCREEN_HEIGHT = 144;
+    static constexpr uint32_t OAM_SCAN_CYCLES = 80;
+    static constexpr uint32_t DRAWING_CYCLES = 172;
+    static constexpr uint32_t LINE_CYCLES = 456;
+    static constexpr uint32_t LINES = 154;
+    static constexpr uint32_t FRAME_CYCLES = LINE_CYCLES * LINES;   // 70224, ~59.73 frames per second
+    static constexpr uint32_t DMA_CYCLES = 640;
+    static constexpr int TILE_COUNT = 384;              // 0x8000-0x97FF, 16 bytes each
+    static constexpr int SPRITES_PER_LINE = 10;
+
+    // Register offsets in bus.high
+    static constexpr uint8_t LCDC = 0x40;
+    static constexpr uint8_t STAT = 0x41;
+    static constexpr uint8_t SCY  = 0x42;
+    static constexpr uint8_t SCX  = 0x43;
+    static constexpr uint8_t LY   = 0x44;
+    static constexpr uint8_t LYC  = 0x45;
+    static constexpr uint8_t DMA  = 0x46;
+    static constexpr uint8_t BGP  = 0x47;
+    static constexpr uint8_t OBP0 = 0x48;
+    static constexpr uint8_t OBP1 = 0x49;
+    static constexpr uint8_t WY   = 0x4A;
+    static constexpr uint8_t WX   = 0x4B;
+
+    Bus& bus;
+    Scheduler& scheduler;
+    const PixelKernels::Table& kernels = PixelKernels::active();
+
+    // Shade (0-3, after the palette) of every pixel of the last frame, row by row
+    std::array<uint8_t, SCREEN_WIDTH * SCREEN_HEIGHT> framebuffer{};
+
+    // Tile cache, color indices (0-3) of the 8x8 pixels of every tile, row by row
+    std::array<std::array<uint8_t, 64>, TILE_COUNT> tiles{};
+    std::array<bool, TILE_COUNT> tile_dirty;
+
+    // Window state for the current frame: it starts once LY has matched WY and has its own line counter
+    bool window_triggered = false;
+    uint8_t window_line = 0;
+
+    Mode mode = OAM_SCAN;
+    uint8_t ly = 0;
+    bool stat_line = false;     // STAT interrupt fires on the rising edge of this
+    bool frame_ready = false;   // Set when VBlank starts, cleared by whoever consumes the frame
+    bool skip_render = false;   // No pixel output (frames nobody will see), timing and interrupts are unaffected
+    bool doctor_ly = false;     // LY always reads 0x90, like the emulator gameboy-doctor reference logs come from
+    uint64_t frames = 0;
+
+    PPU(Bus& bus, Scheduler& scheduler);
+    PPU(const PPU&) = delete;
+    PPU& operator=(const PPU&) = delete;
+
+    bool lcd_enabled() const { return bus.high[LCDC] & 0x80; }
+
+    // Scheduler events
+    void mode_change(uint64_t time);
+    void dma_done(uint64_t time);
+
+    void enter_mode(Mode new_mode, uint64_t time);
+    void set_ly(uint8_t line);
+    void update_stat();
+
+    // Decoded pixels of a tile (index 0-383), decoding it first if its bytes changed
+    const uint8_t* tile(int index) {
+        if (tile_dirty[index]) {
+            decode_tile(index);
+        }
+        return tiles[index].data();
+    }
+    void decode_tile(int index);
+    // Every tile has to be decoded again, for when VRAM is replaced wholesale
+    void invalidate_tiles() { tile_dirty.fill(true); }
+
+    void render_line();
+    void render_background(uint8_t* indices);
+    void render_window(uint8_t* indices);
+    void render_sprites(const uint8_t* bg_indices, uint8_t* line);
+
+    void write_vram_tile(uint16_t address, uint8_t value);
+    void write_lcdc(uint8_t value);
+    void write_stat(uint8_t value);
+    void write_lyc(uint8_t value);
+    void write_dma(uint8_t value);
+};
+
+#endif
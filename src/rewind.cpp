@@ -0,0 +1,147 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// A literal run ends at the first stretch of this many unchanged bytes, shorter gaps cost less kept in the literal
+constexpr size_t MIN_ZERO_RUN = 8;
+
+void put_varint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+size_t get_varint(const uint8_t*& in) {
+    size_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    return value | (size_t)*in++ << shift;
+}
+
+// Bytes from `i` on that are the same in both, 8 at a time
+size_t equal_run(const uint8_t* a, const uint8_t* b, size_t i, size_t size) {
+    size_t start = i;
+    while (i + 8 <= size) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        if (x != y) {
+            break;
+        }
+        i += 8;
+    }
+    while (i < size && a[i] == b[i]) {
+        i++;
+    }
+    return i - start;
+}
+
+// Delta from `a` to `b`: (unchanged count, changed count, changed bytes XORed) until the end
+void encode(const uint8_t* a, const uint8_t* b, size_t size, std::vector<uint8_t>& out) {
+    out.clear();
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros = equal_run(a, b, i, size);
+        i += zeros;
+        size_t start = i;
+        while (i < size) {
+            size_t run = equal_run(a, b, i, std::min(size, i + MIN_ZERO_RUN));
+            if (run == MIN_ZERO_RUN || i + run == size) {
+                break;
+            }
+            i += run + 1;
+        }
+        put_varint(out, zeros);
+        put_varint(out, i - start);
+        for (size_t j = start; j < i; j++) {
+            out.push_back(a[j] ^ b[j]);
+        }
+    }
+}
+
+// XORs a delta into `state`, turning either end of it into the other
+void apply(const uint8_t* delta, size_t delta_size, uint8_t* state) {
+    const uint8_t* in = delta;
+    const uint8_t* end = delta + delta_size;
+    while (in < end) {
+        state += get_varint(in);
+        size_t literal = get_varint(in);
+        for (size_t j = 0; j < literal; j++) {
+            state[j] ^= in[j];
+        }
+        state += literal;
+        in += literal;
+    }
+}
+
+} // namespace
+
+RewindBuffer::RewindBuffer(size_t capacity, size_t max_states)
+    : ring(capacity), max_records(max_states > 0 ? max_states - 1 : 0) {}
+
+void RewindBuffer::push(const std::vector<uint8_t>& state) {
+    if (!has_current || current.size() != state.size()) {
+        clear();
+        current = state;
+        has_current = true;
+        return;
+    }
+    encode(state.data(), current.data(), state.size(), scratch);
+    current = state;
+    if (scratch.size() > ring.size() || max_records == 0) {
+        records.clear();    // Doesn't fit at all, the history restarts here
+        return;
+    }
+
+    // Right after the newest delta, or back at the start when it doesn't fit before the end
+    size_t offset = records.empty() ? 0 : records.back().offset + records.back().size;
+    if (offset + scratch.size() > ring.size()) {
+        offset = 0;
+    }
+    while (!records.empty()) {
+        const Record& oldest = records.front();
+        bool overlaps = oldest.offset < offset + scratch.size() && offset < oldest.offset + oldest.size;
+        if (!overlaps && records.size() < max_records) {
+            break;
+        }
+        records.pop_front();
+    }
+    std::memcpy(ring.data() + offset, scratch.data(), scratch.size());
+    records.push_back(Record{offset, scratch.size()});
+}
+
+bool RewindBuffer::pop(std::vector<uint8_t>& state) {
+    if (!has_current) {
+        return false;
+    }
+    state = current;
+    if (records.empty()) {
+        has_current = false;
+        return true;
+    }
+    const Record& newest = records.back();
+    apply(ring.data() + newest.offset, newest.size, current.data());
+    records.pop_back();
+    return true;
+}
+
+void RewindBuffer::clear() {
+    records.clear();
+    has_current = false;
+}
+
+size_t RewindBuffer::bytes_used() const {
+    size_t total = current.size();
+    for (const Record& record : records) {
+        total += record.size;
+    }
+    return total;
+}
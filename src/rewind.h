@@ -0,0 +1,41 @@
+// Header file for the RewindBuffer
+// History of save states for stepping the game backwards. Only the newest state is kept whole, every older one is
+// stored as the XOR of itself and the state after it, run-length coded: most of the machine doesn't change from one
+// frame to the next so a delta is mostly zero runs, a few hundred bytes to a few kB instead of ~48kB
+// The deltas live back to back in one fixed-size byte ring, the oldest ones are overwritten when it is full
+// Stepping back applies the newest delta to the current state, which gives the state before it
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+struct RewindBuffer {
+    struct Record {
+        size_t offset;      // In `ring`
+        size_t size;
+    };
+
+    std::vector<uint8_t> ring;
+    std::deque<Record> records;     // Oldest first
+    size_t max_records;
+    std::vector<uint8_t> current;   // Newest state, whole
+    bool has_current = false;
+    std::vector<uint8_t> scratch;   // Encoded delta being built
+
+    // `capacity` bytes of deltas and at most `max_states` states (counting the current one)
+    RewindBuffer(size_t capacity, size_t max_states);
+
+    // Adds the newest state. States of a different size (another ROM) start a new history
+    void push(const std::vector<uint8_t>& state);
+    // Takes the newest state out into `state`, the one before it becomes the newest. Returns false when empty
+    bool pop(std::vector<uint8_t>& state);
+    void clear();
+
+    size_t count() const { return has_current ? records.size() + 1 : 0; }
+    size_t bytes_used() const;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "save_state.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <type_traits>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+// The same walk over the machine measures, writes and reads a state, so the three can't disagree on the layout
+struct Measure {
+    size_t size = 0;
+    void bytes(const void*, size_t count) { size += count; }
+};
+
+struct Writer {
+    uint8_t* out;
+    void bytes(const void* source, size_t count) {
+        std::memcpy(out, source, count);
+        out += count;
+    }
+};
+
+struct Reader {
+    const uint8_t* in;
+    void bytes(void* destination, size_t count) {
+        std::memcpy(destination, in, count);
+        in += count;
+    }
+};
+
+template <typename Stream, typename T>
+void field(Stream& stream, T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "Only plain data goes into a state");
+    stream.bytes(&value, sizeof(T));
+}
+
+template <typename Stream>
+void transfer(GameBoy& gameboy, Stream& stream) {
+    CPU& cpu = gameboy.cpu;
+    field(stream, cpu.reg);
+    field(stream, cpu.ime);
+    field(stream, cpu.ime_pending);
+    field(stream, cpu.halted);
+    field(stream, cpu.cycles);
+
+    Bus& bus = gameboy.bus;
+    field(stream, bus.vram);
+    field(stream, bus.eram);
+    field(stream, bus.wram);
+    field(stream, bus.oam);
+    field(stream, bus.high);
+
+    Cartridge& cart = gameboy.cartridge;
+    stream.bytes(cart.ram.data(), cart.ram.size());
+    field(stream, cart.ram_enabled);
+    field(stream, cart.rom_bank);
+    field(stream, cart.bank_low);
+    field(stream, cart.bank_high);
+    field(stream, cart.ram_bank);
+    field(stream, cart.advanced_mode);
+    field(stream, cart.rtc_latched);
+    field(stream, cart.rtc_halted);
+    field(stream, cart.rtc_day_carry);
+    field(stream, cart.rtc_latch_last);
+
+    // Callbacks and contexts stay, they point into this machine. The heap is kept as is so events due at the same
+    // cycle fire in the same order after a load
+    Scheduler& scheduler = gameboy.scheduler;
+    field(stream, scheduler.heap);
+    field(stream, scheduler.size);
+    field(stream, scheduler.slot);
+
+    Timer& timer = gameboy.timer;
+    field(stream, timer.divider_origin);
+    field(stream, timer.tima_origin);
+    field(stream, timer.tima);
+    field(stream, timer.tma);
+    field(stream, timer.tac);
+
+    PPU& ppu = gameboy.ppu;
+    field(stream, ppu.framebuffer);
+    field(stream, ppu.window_triggered);
+    field(stream, ppu.window_line);
+    field(stream, ppu.mode);
+    field(stream, ppu.ly);
+    field(stream, ppu.stat_line);
+    field(stream, ppu.frames);
+
+    APU& apu = gameboy.apu;
+    field(stream, apu.channels);
+    field(stream, apu.powered);
+    field(stream, apu.sequencer_step);
+    field(stream, apu.sweep_enabled);
+    field(stream, apu.sweep_timer);
+    field(stream, apu.sweep_shadow);
+    field(stream, apu.lfsr);
+}
+
+void fill_header(const Cartridge& cart, SaveState::Header& header, size_t body_size) {
+    header = SaveState::Header{};
+    std::memcpy(header.magic, "MCGB", 4);
+    header.version = SaveState::VERSION;
+    header.header_size = sizeof(SaveState::Header);
+    header.body_size = (uint32_t)body_size;
+    header.rom_checksum = (uint16_t)((cart.rom[0x014E] << 8) | cart.rom[0x014F]);
+    header.cartridge_type = cart.type;
+    std::memcpy(header.title, cart.title.data(), std::min(cart.title.size(), sizeof(header.title)));
+}
+
+size_t body_size(GameBoy& gameboy) {
+    Measure measure;
+    transfer(gameboy, measure);
+    return measure.size;
+}
+
+} // namespace
+
+namespace SaveState {
+
+size_t size(GameBoy& gameboy) {
+    return sizeof(Header) + body_size(gameboy);
+}
+
+bool save(GameBoy& gameboy, std::vector<uint8_t>& out) {
+    const Cartridge& cart = gameboy.cartridge;
+    if (!cart.rom) {
+        return false;
+    }
+    // The MBC3 clock is stored as its current reading, the host time it's based on means nothing on another run
+    int64_t rtc = cart.mapper == Cartridge::Mapper::mbc3 ? (int64_t)cart.rtc_seconds() : 0;
+
+    size_t body = body_size(gameboy);
+    out.resize(sizeof(Header) + body + sizeof(rtc));
+    Header header;
+    fill_header(cart, header, body + sizeof(rtc));
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    Writer writer{out.data() + sizeof(Header)};
+    transfer(gameboy, writer);
+    writer.bytes(&rtc, sizeof(rtc));
+    return true;
+}
+
+bool load(GameBoy& gameboy, const uint8_t* data, size_t size) {
+    Cartridge& cart = gameboy.cartridge;
+    if (!cart.rom) {
+        spdlog::error("Estado nao carregado: nenhum cartucho inserido");
+        return false;
+    }
+    Header header;
+    if (size < sizeof(Header)) {
+        spdlog::error("Estado invalido: {} bytes", size);
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    Header expected;
+    int64_t rtc = 0;
+    fill_header(cart, expected, body_size(gameboy) + sizeof(rtc));
+    if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+        spdlog::error("Estado invalido: assinatura desconhecida");
+        return false;
+    }
+    if (header.version != VERSION || header.header_size != sizeof(Header)) {
+        spdlog::error("Estado de uma versao incompativel ({}, esperada {})", header.version, VERSION);
+        return false;
+    }
+    if (header.rom_checksum != expected.rom_checksum || header.cartridge_type != expected.cartridge_type ||
+        std::memcmp(header.title, expected.title, sizeof(header.title)) != 0) {
+        spdlog::error("Estado de outra ROM ('{}')", std::string(header.title, std::find(header.title, std::end(header.title), '\0')));
+        return false;
+    }
+    if (header.body_size != expected.body_size || size != sizeof(Header) + header.body_size) {
+        spdlog::error("Estado com tamanho inesperado ({} bytes)", size);
+        return false;
+    }
+
+    // What the APU already put on the blip buffers stays there, its levels and frame timing have to carry over
+    APU& apu = gameboy.apu;
+    std::array<int, 4> amplitudes;
+    for (int i = 0; i < 4; i++) {
+        amplitudes[i] = apu.channels[i].amplitude;
+    }
+    uint64_t frame_elapsed = gameboy.cpu.cycles - apu.frame_start;
+
+    Reader reader{data + sizeof(Header)};
+    transfer(gameboy, reader);
+    reader.bytes(&rtc, sizeof(rtc));
+
+    if (cart.mapper == Cartridge::Mapper::mbc3) {
+        cart.rtc_set_seconds((time_t)rtc);
+    }
+    if (cart.bus) {
+        cart.update_rom_mapping();
+        cart.update_ram_mapping();
+    }
+    gameboy.ppu.invalidate_tiles();
+    gameboy.cpu.blocks.invalidate_ram();
+    for (int i = 0; i < 4; i++) {
+        apu.channels[i].amplitude = amplitudes[i];
+    }
+    apu.frame_start = gameboy.cpu.cycles - frame_elapsed;
+    apu.refresh_output(gameboy.cpu.cycles);
+    return true;
+}
+
+bool save_file(GameBoy& gameboy, const std::string& path) {
+    std::vector<uint8_t> state;
+    if (!save(gameboy, state)) {
+        return false;
+    }
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(state.data()), (std::streamsize)state.size());
+    if (!file) {
+        spdlog::error("Falha ao gravar o estado em '{}'", path);
+        return false;
+    }
+    spdlog::info("Estado gravado em '{}' ({} bytes)", path, state.size());
+    return true;
+}
+
+bool load_file(GameBoy& gameboy, const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        spdlog::error("Nao foi possivel abrir o estado '{}'", path);
+        return false;
+    }
+    std::vector<uint8_t> state((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!load(gameboy, state.data(), state.size())) {
+        return false;
+    }
+    spdlog::info("Estado carregado de '{}'", path);
+    return true;
+}
+
+} // namespace SaveState
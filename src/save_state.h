@@ -0,0 +1,46 @@
+// Header file for the save states
+// A snapshot of the whole machine (CPU, bus memory, mapper, scheduler, timer, PPU, APU) in a compact binary
+// format: a small header, then every component's state as raw bytes in a fixed order. The big pieces (VRAM, WRAM,
+// cartridge RAM, framebuffer) are single memcpys and the rest is a few dozen small ones, a state is taken or
+// restored in microseconds, fast enough for rewind and run-ahead to do it every frame
+// Values are stored in host byte order, a state is meant for the machine (and the ROM) it was made on
+// Not part of a state: the ROM itself, the tile cache (rebuilt), the audio already synthesized and the joypad
+// (input belongs to whoever restores the state)
+#ifndef SAVE_STATE_H
+#define SAVE_STATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gameboy.h"
+
+namespace SaveState {
+    // Bumped whenever the layout changes, older states are refused rather than misread
+    constexpr uint16_t VERSION = 1;
+
+    struct Header {
+        char magic[4];              // "MCGB"
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t body_size;
+        uint16_t rom_checksum;      // Global checksum of the ROM header (0x014E-0x014F)
+        uint8_t cartridge_type;
+        uint8_t reserved;
+        char title[16];
+    };
+
+    // Size of a state of this machine, it only depends on the cartridge (RAM size)
+    size_t size(GameBoy& gameboy);
+    // Writes a state into `out`, reusing its memory when it is already big enough. Returns false without a cartridge
+    bool save(GameBoy& gameboy, std::vector<uint8_t>& out);
+    // Restores a state. Returns false (and logs why) if it is not a state of this ROM and version, the machine is
+    // left untouched then
+    bool load(GameBoy& gameboy, const uint8_t* data, size_t size);
+
+    bool save_file(GameBoy& gameboy, const std::string& path);
+    bool load_file(GameBoy& gameboy, const std::string& path);
+}
+
+#endif
@@ -0,0 +1,159 @@
+// Header file for the Scheduler
+// Central list of timestamped hardware events (PPU mode changes, timer overflow, DMA end, serial, APU frame sequencer)
+// The CPU runs instruction after instruction until the next deadline and the due events are fired afterwards, so no
+// component has to be ticked every cycle
+// It's a small indexed binary min-heap, every event type is either pending once or not at all
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+enum class Event : uint8_t {
+    ppu_mode,
+    timer_overflow,
+    oam_dma,
+    serial_transfer,
+    apu_frame_sequencer,
+    COUNT
+};
+
+struct Scheduler {
+    static constexpr int EVENT_COUNT = (int)Event::COUNT;
+    static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+    // `time` is when the event was due, it can be a few cycles behind the clock since instructions aren't split
+    using Callback = void (*)(void* context, uint64_t time);
+
+    struct Entry {
+        uint64_t time;
+        Event event;
+    };
+
+    const uint64_t& clock;      // CPU cycle counter
+    std::array<Entry, EVENT_COUNT> heap;
+    int size = 0;
+    std::array<int, EVENT_COUNT> slot;  // Heap index of each event type, -1 when not scheduled
+    std::array<Callback, EVENT_COUNT> callbacks{};
+    std::array<void*, EVENT_COUNT> contexts{};
+
+    explicit Scheduler(const uint64_t& clock) : clock(clock) {
+        slot.fill(-1);
+    }
+
+    uint64_t now() const { return clock; }
+
+    void set_callback(Event event, void* context, Callback callback) {
+        callbacks[(int)event] = callback;
+        contexts[(int)event] = context;
+    }
+
+    bool pending(Event event) const {
+        return slot[(int)event] >= 0;
+    }
+
+    uint64_t time_of(Event event) const {
+        int index = slot[(int)event];
+        return index >= 0 ? heap[index].time : NEVER;
+    }
+
+    // Deadline for the CPU, it can run until this cycle without missing anything
+    uint64_t next_time() const {
+        return size > 0 ? heap[0].time : NEVER;
+    }
+
+    // Schedules (or reschedules) an event type
+    void schedule(Event event, uint64_t time) {
+        int index = slot[(int)event];
+        if (index < 0) {
+            index = size++;
+            heap[index] = Entry{time, event};
+            slot[(int)event] = index;
+            sift_up(index);
+            return;
+        }
+        uint64_t old_time = heap[index].time;
+        heap[index].time = time;
+        if (time < old_time) {
+            sift_up(index);
+        } else {
+            sift_down(index);
+        }
+    }
+
+    void cancel(Event event) {
+        int index = slot[(int)event];
+        if (index < 0) {
+            return;
+        }
+        remove_at(index);
+    }
+
+    // Fires every event that is due, in time order
+    void dispatch() {
+        while (size > 0 && heap[0].time <= clock) {
+            Entry entry = heap[0];
+            remove_at(0);
+            int type = (int)entry.event;
+            if (callbacks[type]) {
+                callbacks[type](contexts[type], entry.time);
+            }
+        }
+    }
+
+private:
+    void place(int index, const Entry& entry) {
+        heap[index] = entry;
+        slot[(int)entry.event] = index;
+    }
+
+    void remove_at(int index) {
+        slot[(int)heap[index].event] = -1;
+        size--;
+        if (index == size) {
+            return;
+        }
+        // Move the last entry into the hole and let it find its place
+        place(index, heap[size]);
+        if (index > 0 && heap[(index - 1) / 2].time > heap[index].time) {
+            sift_up(index);
+        } else {
+            sift_down(index);
+        }
+    }
+
+    void sift_up(int index) {
+        Entry entry = heap[index];
+        while (index > 0) {
+            int parent = (index - 1) / 2;
+            if (heap[parent].time <= entry.time) {
+                break;
+            }
+            place(index, heap[parent]);
+            index = parent;
+        }
+        place(index, entry);
+    }
+
+    void sift_down(int index) {
+        Entry entry = heap[index];
+        while (true) {
+            int child = index * 2 + 1;
+            if (child >= size) {
+                break;
+            }
+            if (child + 1 < size && heap[child + 1].time < heap[child].time) {
+                child++;
+            }
+            if (entry.time <= heap[child].time) {
+                break;
+            }
+            place(index, heap[child]);
+            index = child;
+        }
+        place(index, entry);
+    }
+};
+
+#endif
@@ -0,0 +1,40 @@
+#include "serial.h"
+
+namespace {
+
+void control_write(void* context, uint16_t, uint8_t value) {
+    static_cast<Serial*>(context)->write_control(value);
+}
+
+// Unused bits of SC read as 1
+uint8_t control_read(void* context, uint16_t) {
+    return static_cast<Serial*>(context)->bus.high[0x02] | 0x7E;
+}
+
+void serial_transfer_done(void* context, uint64_t time) {
+    static_cast<Serial*>(context)->transfer_done(time);
+}
+
+} // namespace
+
+Serial::Serial(Bus& bus, Scheduler& scheduler) : bus(bus), scheduler(scheduler) {
+    bus.map_io(0xFF02, this, control_read, control_write);
+    scheduler.set_callback(Event::serial_transfer, this, serial_transfer_done);
+}
+
+void Serial::write_control(uint8_t value) {
+    bus.high[0x02] = value & 0x81;
+    // Only the internal clock drives a transfer, with an external one it would wait for a partner forever
+    if ((value & 0x81) == 0x81) {
+        scheduler.schedule(Event::serial_transfer, scheduler.now() + TRANSFER_CYCLES);
+    } else {
+        scheduler.cancel(Event::serial_transfer);
+    }
+}
+
+void Serial::transfer_done(uint64_t) {
+    output.push_back((char)bus.high[0x01]);
+    bus.high[0x01] = 0xFF;
+    bus.high[0x02] &= 0x7F;
+    bus.request_interrupt(Interrupt::SERIAL);
+}
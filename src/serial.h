@@ -0,0 +1,28 @@
+// Header file for the Serial port (SB 0xFF01, SC 0xFF02)
+// There is never anything on the other end of the link cable, a transfer started with the internal clock shifts the
+// byte out and 0xFF in. Every byte sent is kept in `output`, test ROMs print their results this way
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <cstdint>
+#include <string>
+
+#include "bus.h"
+#include "scheduler.h"
+
+struct Serial {
+    static constexpr uint32_t TRANSFER_CYCLES = 8 * 512;    // 8 bits at 8192 Hz
+
+    Bus& bus;
+    Scheduler& scheduler;
+    std::string output;
+
+    Serial(Bus& bus, Scheduler& scheduler);
+    Serial(const Serial&) = delete;
+    Serial& operator=(const Serial&) = delete;
+
+    void write_control(uint8_t value);
+    void transfer_done(uint64_t time);
+};
+
+#endif
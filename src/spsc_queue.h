@@ -0,0 +1,69 @@
+// Header file for the SpscQueue
+// Bounded lock-free ring for exactly one producer and one consumer thread (frontend -> emulation commands, and later
+// emulation -> audio samples). Push fails instead of blocking when it is full
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+template <typename T, size_t Capacity>
+struct SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    static constexpr size_t MASK = Capacity - 1;
+
+    std::array<T, Capacity> items{};
+    // Free running counters, each written by one side only and on separate cache lines
+    alignas(64) std::atomic<size_t> head{0};    // Next item to pop, written by the consumer
+    alignas(64) std::atomic<size_t> tail{0};    // Next slot to push, written by the producer
+
+    bool push(const T& item) {
+        size_t write = tail.load(std::memory_order_relaxed);
+        if (write - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[write & MASK] = item;
+        tail.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t read = head.load(std::memory_order_relaxed);
+        if (read == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[read & MASK];
+        head.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Bulk versions for audio samples, as many as fit (or are there). Return how many were moved
+    size_t push(const T* source, size_t count) {
+        size_t write = tail.load(std::memory_order_relaxed);
+        count = std::min(count, Capacity - (write - head.load(std::memory_order_acquire)));
+        for (size_t i = 0; i < count; i++) {
+            items[(write + i) & MASK] = source[i];
+        }
+        tail.store(write + count, std::memory_order_release);
+        return count;
+    }
+
+    size_t pop(T* destination, size_t count) {
+        size_t read = head.load(std::memory_order_relaxed);
+        count = std::min(count, tail.load(std::memory_order_acquire) - read);
+        for (size_t i = 0; i < count; i++) {
+            destination[i] = items[(read + i) & MASK];
+        }
+        head.store(read + count, std::memory_order_release);
+        return count;
+    }
+
+    // Only exact when called from one of the two sides while the other is idle, a hint otherwise
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+};
+
+#endif
@@ -0,0 +1,280 @@
+// Entry point of McGB_test_runner, runs a directory of test ROMs headless on a pool of worker threads
+// Each ROM gets its own GameBoy, so one worker per core scales with no shared state apart from the job counter
+// A ROM passes or fails by what it reports:
+//   - Blargg: "Passed" / "Failed" on the serial port, or the 0xA000 status block (signature DE B0 61)
+//   - Mooneye: Fibonacci bytes 3 5 8 13 21 34 on the serial port for a pass, six 0x42 for a failure
+//   - Anything else (dmg-acid2...): the framebuffer hash, compared with the expectations file
+//
+//   ./McGB_test_runner <dir> [--jobs N] [--frames N] [--expect FILE] [--record FILE]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "gameboy.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+enum class Status { pass, fail, timeout, error };
+
+struct Job {
+    fs::path path;
+    std::string name;       // Path relative to the ROM directory
+    uint64_t expected_hash = 0;
+    bool has_expected_hash = false;
+};
+
+struct Result {
+    Status status = Status::error;
+    std::string method;     // How the verdict was reached
+    uint64_t frames = 0;
+    uint64_t hash = 0;      // Framebuffer hash at the end of the run
+    double seconds = 0;
+};
+
+struct Options {
+    fs::path directory;
+    unsigned jobs = 0;              // 0 = one per core
+    uint64_t max_frames = 60 * 120; // Two emulated minutes, enough for the long Blargg suites
+    fs::path expect_path;
+    fs::path record_path;
+};
+
+const char* status_name(Status status) {
+    switch (status) {
+        case Status::pass    : return "PASS";
+        case Status::fail    : return "FAIL";
+        case Status::timeout : return "TIMEOUT";
+        case Status::error   : return "ERROR";
+    }
+    return "?";
+}
+
+uint64_t framebuffer_hash(const PPU& ppu) {
+    uint64_t hash = 1469598103934665603ull;     // FNV-1a
+    for (uint8_t pixel : ppu.framebuffer) {
+        hash = (hash ^ pixel) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Verdict from the serial output so far, returns false while there is none
+bool serial_verdict(const std::string& output, Result& result) {
+    static const std::string mooneye_pass("\x03\x05\x08\x0D\x15\x22", 6);
+    static const std::string mooneye_fail(6, '\x42');
+    if (output.find("Passed") != std::string::npos) {
+        result.status = Status::pass;
+    } else if (output.find("Failed") != std::string::npos) {
+        result.status = Status::fail;
+    } else if (output.find(mooneye_pass) != std::string::npos) {
+        result.status = Status::pass;
+    } else if (output.find(mooneye_fail) != std::string::npos) {
+        result.status = Status::fail;
+    } else {
+        return false;
+    }
+    result.method = "serial";
+    return true;
+}
+
+// Newer Blargg ROMs also report through cartridge RAM: A001-A003 = DE B0 61, A000 = 0x80 while running, then the
+// result code (0 = passed)
+bool memory_verdict(Bus& bus, Result& result) {
+    if (bus.read_memory(0xA001) != 0xDE || bus.read_memory(0xA002) != 0xB0 || bus.read_memory(0xA003) != 0x61) {
+        return false;
+    }
+    uint8_t code = bus.read_memory(0xA000);
+    if (code == 0x80) {
+        return false;
+    }
+    result.status = code == 0 ? Status::pass : Status::fail;
+    result.method = "memory";
+    return true;
+}
+
+Result run_rom(const Job& job, const Options& options) {
+    Result result;
+    auto start = std::chrono::steady_clock::now();
+    auto gameboy = std::make_unique<GameBoy>();
+
+    if (!gameboy->insert_cartridge(job.path.string())) {
+        result.method = "load";
+    } else {
+        result.status = Status::timeout;
+        result.method = job.has_expected_hash ? "screen" : "-";
+        // The cartridge RAM status block is only readable once the ROM enables RAM, so it is polled like the rest
+        while (result.frames < options.max_frames) {
+            gameboy->run_frame();
+            result.frames++;
+            if (serial_verdict(gameboy->serial.output, result)) {
+                break;
+            }
+            if (result.frames % 16 == 0 && memory_verdict(gameboy->bus, result)) {
+                break;
+            }
+            if (job.has_expected_hash && result.frames % 8 == 0 && framebuffer_hash(gameboy->ppu) == job.expected_hash) {
+                result.status = Status::pass;
+                break;
+            }
+        }
+        result.hash = framebuffer_hash(gameboy->ppu);
+        if (result.status == Status::timeout && job.has_expected_hash) {
+            result.status = Status::fail;
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Expectations file: one "<rom path relative to the directory> <hash in hex>" per line, # starts a comment
+std::map<std::string, uint64_t> load_expectations(const fs::path& path) {
+    std::map<std::string, uint64_t> expected;
+    std::ifstream file(path);
+    std::string name, hash;
+    while (file >> name) {
+        if (name[0] == '#') {
+            std::getline(file, hash);
+            continue;
+        }
+        if (file >> hash) {
+            expected[name] = std::strtoull(hash.c_str(), nullptr, 16);
+        }
+    }
+    return expected;
+}
+
+bool parse_args(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(arg, "--jobs") == 0 && has_value) {
+            options.jobs = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--frames") == 0 && has_value) {
+            options.max_frames = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(arg, "--expect") == 0 && has_value) {
+            options.expect_path = argv[++i];
+        } else if (std::strcmp(arg, "--record") == 0 && has_value) {
+            options.record_path = argv[++i];
+        } else if (arg[0] != '-' && options.directory.empty()) {
+            options.directory = arg;
+        } else {
+            return false;
+        }
+    }
+    return !options.directory.empty() && options.max_frames > 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    // Illegal opcodes and bad headers are part of what some test ROMs do, the table below is the output
+    spdlog::set_level(spdlog::level::off);
+
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        std::printf("Usage: %s <rom directory> [--jobs N] [--frames N] [--expect FILE] [--record FILE]\n", argv[0]);
+        return 2;
+    }
+    if (!fs::is_directory(options.directory)) {
+        std::printf("Not a directory: %s\n", options.directory.string().c_str());
+        return 2;
+    }
+    if (options.expect_path.empty() && fs::exists(options.directory / "expected_hashes.txt")) {
+        options.expect_path = options.directory / "expected_hashes.txt";
+    }
+    std::map<std::string, uint64_t> expected;
+    if (!options.expect_path.empty()) {
+        expected = load_expectations(options.expect_path);
+    }
+
+    std::vector<Job> jobs;
+    for (const auto& entry : fs::recursive_directory_iterator(options.directory)) {
+        std::string extension = entry.path().extension().string();
+        if (!entry.is_regular_file() || (extension != ".gb" && extension != ".gbc")) {
+            continue;
+        }
+        Job job;
+        job.path = entry.path();
+        job.name = fs::relative(entry.path(), options.directory).generic_string();
+        auto it = expected.find(job.name);
+        if (it != expected.end()) {
+            job.expected_hash = it->second;
+            job.has_expected_hash = true;
+        }
+        jobs.push_back(job);
+    }
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.name < b.name; });
+    if (jobs.empty()) {
+        std::printf("No .gb/.gbc files in %s\n", options.directory.string().c_str());
+        return 2;
+    }
+
+    // Workers take the next ROM off a shared counter, each result slot is written by exactly one worker
+    unsigned worker_count = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    worker_count = std::min<unsigned>(worker_count, (unsigned)jobs.size());
+    std::vector<Result> results(jobs.size());
+    std::atomic<size_t> next{0};
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < worker_count; i++) {
+        workers.emplace_back([&]() {
+            for (size_t index = next++; index < jobs.size(); index = next++) {
+                results[index] = run_rom(jobs[index], options);
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Summary table
+    size_t name_width = 3;
+    for (const Job& job : jobs) {
+        name_width = std::max(name_width, job.name.size());
+    }
+    int counts[4] = {};
+    std::printf("%-*s  %-7s  %-6s  %7s  %8s  %s\n", (int)name_width, "ROM", "RESULT", "BY", "FRAMES", "TIME", "HASH");
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const Result& result = results[i];
+        counts[(int)result.status]++;
+        std::printf("%-*s  %-7s  %-6s  %7llu  %7.2fs  %016llx\n", (int)name_width, jobs[i].name.c_str(),
+                    status_name(result.status), result.method.c_str(), (unsigned long long)result.frames,
+                    result.seconds, (unsigned long long)result.hash);
+    }
+    std::printf("\n%zu ROMs: %d passed, %d failed, %d timed out, %d errors in %.2fs on %u threads\n", jobs.size(),
+                counts[(int)Status::pass], counts[(int)Status::fail], counts[(int)Status::timeout],
+                counts[(int)Status::error], wall, worker_count);
+
+    // Hashes of the ROMs that gave no serial/memory verdict, to be checked by eye once and kept as expectations
+    if (!options.record_path.empty()) {
+        std::ofstream record(options.record_path);
+        record << "# <rom> <framebuffer hash>, written by McGB_test_runner --record\n";
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const Result& result = results[i];
+            if (result.method == "-" || result.method == "screen") {
+                char hash[17];
+                std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)result.hash);
+                record << jobs[i].name << ' ' << hash << '\n';
+            }
+        }
+    }
+
+    return counts[(int)Status::pass] == (int)jobs.size() ? 0 : 1;
+}
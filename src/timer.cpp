@@ -0,0 +1,85 @@
+#include "timer.h"
+
+namespace {
+
+uint8_t timer_read(void* context, uint16_t address) {
+    return static_cast<Timer*>(context)->read(address);
+}
+
+void timer_write(void* context, uint16_t address, uint8_t value) {
+    static_cast<Timer*>(context)->write(address, value);
+}
+
+void timer_overflow(void* context, uint64_t time) {
+    static_cast<Timer*>(context)->overflow(time);
+}
+
+} // namespace
+
+Timer::Timer(Bus& bus, Scheduler& scheduler) : bus(bus), scheduler(scheduler) {
+    for (uint16_t address = 0xFF04; address <= 0xFF07; address++) {
+        bus.map_io(address, this, timer_read, timer_write);
+    }
+    scheduler.set_callback(Event::timer_overflow, this, timer_overflow);
+    // DIV reads 0xAB right after the boot ROM
+    divider_origin = scheduler.now() - 0xABCC;
+    tima_origin = scheduler.now();
+}
+
+void Timer::sync(uint64_t now) {
+    if (enabled()) {
+        // Ticks between the two times = how many multiples of the period the divider went past
+        uint64_t ticks = (now - divider_origin) / period() - (tima_origin - divider_origin) / period();
+        tima = (uint8_t)(tima + ticks);
+    }
+    tima_origin = now;
+}
+
+void Timer::schedule_overflow() {
+    if (!enabled()) {
+        scheduler.cancel(Event::timer_overflow);
+        return;
+    }
+    uint64_t ticks_left = 0x100 - tima;
+    uint64_t next_tick = ((tima_origin - divider_origin) / period() + 1) * period() + divider_origin;
+    scheduler.schedule(Event::timer_overflow, next_tick + (ticks_left - 1) * period());
+}
+
+void Timer::overflow(uint64_t time) {
+    // TIMA wrapped, reload it from TMA and raise the interrupt
+    tima = tma;
+    tima_origin = time;
+    bus.request_interrupt(Interrupt::TIMER);
+    schedule_overflow();
+}
+
+uint8_t Timer::read(uint16_t address) {
+    uint64_t now = scheduler.now();
+    switch (address) {
+        case 0xFF04 : return (uint8_t)(divider(now) >> 8);
+        case 0xFF05 : sync(now); return tima;
+        case 0xFF06 : return tma;
+        default     : return tac | 0xF8;
+    }
+}
+
+void Timer::write(uint16_t address, uint8_t value) {
+    uint64_t now = scheduler.now();
+    sync(now);
+    switch (address) {
+        case 0xFF04 : {
+            // Resetting the divider while the watched bit is high is a falling edge, so TIMA ticks once more
+            if (enabled() && (divider(now) & (period() / 2)) && ++tima == 0) {
+                tima = tma;
+                bus.request_interrupt(Interrupt::TIMER);
+            }
+            divider_origin = now;
+            break;
+        }
+        case 0xFF05 : tima = value; break;
+        case 0xFF06 : tma = value; break;
+        default     : tac = value & 0x07; break;
+    }
+    tima_origin = now;
+    schedule_overflow();
+}
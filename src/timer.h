@@ -0,0 +1,45 @@
+// Header file for the Timer component
+// DIV (0xFF04), TIMA (0xFF05), TMA (0xFF06) and TAC (0xFF07)
+// Nothing here is ticked: DIV is worked out from the CPU cycle counter when it is read, TIMA is caught up on access,
+// and the overflow is a scheduler event placed exactly where TIMA will wrap
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <cstdint>
+
+#include "bus.h"
+#include "scheduler.h"
+
+struct Timer {
+    Bus& bus;
+    Scheduler& scheduler;
+
+    uint64_t divider_origin = 0;    // Cycle at which the internal 16 bit divider was 0
+    uint64_t tima_origin = 0;       // Cycle at which TIMA had the value in `tima`
+    uint8_t tima = 0;
+    uint8_t tma = 0;
+    uint8_t tac = 0xF8;
+
+    Timer(Bus& bus, Scheduler& scheduler);
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    bool enabled() const { return tac & 0x04; }
+    // TIMA ticks every `period` cycles, on the falling edge of one of the divider bits
+    uint32_t period() const {
+        static constexpr uint32_t periods[4] = {1024, 16, 64, 256};
+        return periods[tac & 0x03];
+    }
+    uint16_t divider(uint64_t now) const { return (uint16_t)(now - divider_origin); }
+
+    // Brings `tima` up to date with the clock
+    void sync(uint64_t now);
+    // (Re)places the overflow event for the current TIMA value
+    void schedule_overflow();
+    void overflow(uint64_t time);
+
+    uint8_t read(uint16_t address);
+    void write(uint16_t address, uint8_t value);
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+constexpr char TRACE_MAGIC[8] = {'M', 'C', 'G', 'B', 'T', 'R', 'C', '1'};
+
+bool write_header(std::FILE* file, uint64_t count) {
+    TraceFileHeader header{};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(TraceRecord);
+    header.count = count;
+    std::fseek(file, 0, SEEK_SET);
+    return std::fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+} // namespace
+
+bool TraceRecorder::open(const std::string& path) {
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        spdlog::error("Nao foi possivel criar o trace '{}'", path);
+        return false;
+    }
+    write_header(file, 0);  // The count is filled in by close()
+    buffer.assign(BLOCK_RECORDS, TraceRecord{});
+    used = 0;
+    ring = false;
+    wrapped = false;
+    total = 0;
+    return true;
+}
+
+bool TraceRecorder::open_ring(const std::string& path, size_t capacity) {
+    if (!open(path)) {
+        return false;
+    }
+    buffer.assign(std::max<size_t>(capacity, 1), TraceRecord{});
+    ring = true;
+    return true;
+}
+
+void TraceRecorder::flush_block() {
+    if (ring) {
+        wrapped = true;     // Start over, the oldest records are overwritten from here on
+    } else {
+        std::fwrite(buffer.data(), sizeof(TraceRecord), used, file);
+    }
+    used = 0;
+}
+
+void TraceRecorder::close() {
+    if (!file) {
+        return;
+    }
+    uint64_t count = total;
+    if (ring) {
+        // Oldest first: the part after `used` (when the ring went around), then the start
+        if (wrapped) {
+            std::fwrite(buffer.data() + used, sizeof(TraceRecord), buffer.size() - used, file);
+        }
+        std::fwrite(buffer.data(), sizeof(TraceRecord), used, file);
+        count = wrapped ? buffer.size() : used;
+    } else {
+        std::fwrite(buffer.data(), sizeof(TraceRecord), used, file);
+    }
+    write_header(file, count);
+    std::fclose(file);
+    file = nullptr;
+    used = 0;
+    spdlog::info("Trace fechado: {} instrucoes registradas, {} gravadas", total, count);
+}
+
+std::string format_doctor(const TraceRecord& r) {
+    char line[96];
+    std::snprintf(line, sizeof(line),
+                  "A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X",
+                  r.af >> 8, r.af & 0xFF, r.bc >> 8, r.bc & 0xFF, r.de >> 8, r.de & 0xFF, r.hl >> 8, r.hl & 0xFF,
+                  r.sp, r.pc, r.pcmem[0], r.pcmem[1], r.pcmem[2], r.pcmem[3]);
+    return line;
+}
+
+bool read_trace(const std::string& path, std::vector<TraceRecord>& records) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        spdlog::error("Nao foi possivel abrir o trace '{}'", path);
+        return false;
+    }
+    TraceFileHeader header{};
+    bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+              std::memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0 &&
+              header.record_size == sizeof(TraceRecord);
+    // A count of 0 is a trace whose run never closed it (crash, kill), whatever made it to the file is used
+    records.clear();
+    TraceRecord block[4096];
+    size_t read = 0;
+    while (ok && (read = std::fread(block, sizeof(TraceRecord), 4096, file)) > 0) {
+        records.insert(records.end(), block, block + read);
+    }
+    if (ok && header.count != 0) {
+        ok = records.size() == header.count;
+    }
+    std::fclose(file);
+    if (!ok) {
+        spdlog::error("'{}' nao e um trace valido (ou esta truncado)", path);
+    }
+    return ok;
+}
@@ -0,0 +1,96 @@
+// Header file for the instruction trace
+// Binary per-instruction trace for chasing accuracy regressions: one fixed 24 byte record with the registers, the
+// cycle count and the 4 bytes at PC, taken right before each instruction runs (not for interrupt dispatch or HALT)
+// Records go into a memory buffer and reach the file in large blocks, so tracing costs a few stores and 4 bus reads
+// per instruction instead of a formatted log line
+// Ring mode keeps only the last N records and writes them when the recorder is closed, for "what ran just before
+// it went wrong" on long runs
+// The McGB_trace tool turns a trace into gameboy-doctor text and diffs it against a reference log
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "CPU.h"
+
+struct TraceRecord {
+    uint64_t cycles;
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t af;
+    uint16_t bc;
+    uint16_t de;
+    uint16_t hl;
+    uint8_t pcmem[4];   // Opcode and the 3 bytes after it
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is stored as is");
+
+// File layout: this header, then `count` records, oldest first
+struct TraceFileHeader {
+    char magic[8];          // "MCGBTRC1"
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+struct TraceRecorder {
+    static constexpr size_t BLOCK_RECORDS = 1 << 15;   // 768kB between two writes in stream mode
+
+    std::FILE* file = nullptr;
+    std::vector<TraceRecord> buffer;
+    size_t used = 0;
+    bool ring = false;
+    bool wrapped = false;       // Ring mode: older records were overwritten
+    uint64_t total = 0;         // Records taken since open
+
+    TraceRecorder() = default;
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+    ~TraceRecorder() { close(); }
+
+    // Streams every record to `path`. Returns false (and logs why) if it can't be created
+    bool open(const std::string& path);
+    // Keeps the last `capacity` records, written to `path` by close()
+    bool open_ring(const std::string& path, size_t capacity);
+    void close();
+
+    void record(CPU& cpu) {
+        TraceRecord& r = buffer[used];
+        r.cycles = cpu.cycles;
+        r.pc = cpu.reg.pc;
+        r.sp = cpu.reg.sp;
+        r.af = cpu.reg.get_af();
+        r.bc = cpu.reg.bc;
+        r.de = cpu.reg.de;
+        r.hl = cpu.reg.hl;
+        // Almost always plain memory on one page: a single 4 byte copy instead of 4 bus reads
+        const Bus::Page& page = cpu.bus.pages[cpu.reg.pc >> 8];
+        if (page.read && (cpu.reg.pc & 0xFF) <= 0xFC) {
+            std::memcpy(r.pcmem, page.read + (cpu.reg.pc & 0xFF), 4);
+        } else {
+            for (int i = 0; i < 4; i++) {
+                r.pcmem[i] = cpu.bus.read_memory((uint16_t)(cpu.reg.pc + i));
+            }
+        }
+        total++;
+        if (++used == buffer.size()) {
+            flush_block();
+        }
+    }
+
+private:
+    void flush_block();
+};
+
+// One line of gameboy-doctor text: A:01 F:B0 B:00 C:13 D:00 E:D8 H:01 L:4D SP:FFFE PC:0100 PCMEM:00,C3,13,02
+std::string format_doctor(const TraceRecord& record);
+
+// Reads a whole trace file, returns false (and logs why) if it isn't one
+bool read_trace(const std::string& path, std::vector<TraceRecord>& records);
+
+#endif
@@ -0,0 +1,163 @@
+// Entry point of McGB_trace, reads the binary instruction traces written by `McGB_headless --trace`
+//   dump: prints a trace as gameboy-doctor text, one line per instruction
+//   diff: compares a trace with a gameboy-doctor reference log and shows where they first disagree
+//
+//   ./McGB_trace dump <trace> [--from N] [--count N] [--cycles]
+//   ./McGB_trace diff <trace> <reference.log> [--context N]
+// diff exits with 0 when every instruction both have matches, 1 on a mismatch, 2 on bad arguments or files
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+namespace {
+
+struct Options {
+    std::string command;
+    std::string trace_path;
+    std::string reference_path;
+    uint64_t from = 0;
+    uint64_t count = UINT64_MAX;
+    bool cycles = false;
+    size_t context = 5;
+};
+
+void print_usage(const char* program) {
+    std::printf("Usage: %s dump <trace> [--from N] [--count N] [--cycles]\n"
+                "       %s diff <trace> <reference.log> [--context N]\n", program, program);
+}
+
+bool parse_args(int argc, char* argv[], Options& options) {
+    if (argc < 3) {
+        return false;
+    }
+    options.command = argv[1];
+    options.trace_path = argv[2];
+    int i = 3;
+    if (options.command == "diff") {
+        if (argc < 4) {
+            return false;
+        }
+        options.reference_path = argv[i++];
+    } else if (options.command != "dump") {
+        return false;
+    }
+    for (; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (std::strcmp(argv[i], "--from") == 0 && has_value) {
+            options.from = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--count") == 0 && has_value) {
+            options.count = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--context") == 0 && has_value) {
+            options.context = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--cycles") == 0) {
+            options.cycles = true;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string> split_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    std::string field;
+    while (stream >> field) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+// Reference logs come from many emulators, trailing spaces and CRLF line ends are not a difference
+std::string normalize(std::string line) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ' || line.back() == '\t')) {
+        line.pop_back();
+    }
+    return line;
+}
+
+int dump(const Options& options, const std::vector<TraceRecord>& records) {
+    uint64_t end = std::min<uint64_t>(records.size(), options.from + std::min<uint64_t>(options.count, records.size()));
+    for (uint64_t i = options.from; i < end; i++) {
+        std::string line = format_doctor(records[i]);
+        if (options.cycles) {
+            std::printf("%s CY:%llu\n", line.c_str(), (unsigned long long)records[i].cycles);
+        } else {
+            std::printf("%s\n", line.c_str());
+        }
+    }
+    return 0;
+}
+
+int diff(const Options& options, const std::vector<TraceRecord>& records) {
+    std::ifstream reference(options.reference_path);
+    if (!reference) {
+        std::printf("Can't open %s\n", options.reference_path.c_str());
+        return 2;
+    }
+
+    std::string expected;
+    size_t index = 0;
+    for (; index < records.size() && std::getline(reference, expected); index++) {
+        expected = normalize(expected);
+        std::string actual = format_doctor(records[index]);
+        if (actual == expected) {
+            continue;
+        }
+
+        std::printf("Mismatch at instruction %zu (cycle %llu)\n\n", index, (unsigned long long)records[index].cycles);
+        size_t first = index > options.context ? index - options.context : 0;
+        for (size_t i = first; i < index; i++) {
+            std::printf("  %8zu  %s\n", i, format_doctor(records[i]).c_str());
+        }
+        std::printf("- %8zu  %s   (reference)\n", index, expected.c_str());
+        std::printf("+ %8zu  %s   (trace)\n\n", index, actual.c_str());
+
+        std::vector<std::string> want = split_fields(expected);
+        std::vector<std::string> got = split_fields(actual);
+        std::printf("Differs in:");
+        for (size_t i = 0; i < std::max(want.size(), got.size()); i++) {
+            const std::string& a = i < want.size() ? want[i] : std::string("(none)");
+            const std::string& b = i < got.size() ? got[i] : std::string("(none)");
+            if (a != b) {
+                std::printf(" %s -> %s", a.c_str(), b.c_str());
+            }
+        }
+        std::printf("\n");
+        return 1;
+    }
+
+    bool reference_left = static_cast<bool>(std::getline(reference, expected));
+    std::printf("%zu instructions match", index);
+    if (index < records.size()) {
+        std::printf(", the reference ends there (%zu more in the trace)", records.size() - index);
+    } else if (reference_left) {
+        std::printf(", the trace ends there (the reference goes on)");
+    }
+    std::printf("\n");
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    std::vector<TraceRecord> records;
+    if (!read_trace(options.trace_path, records)) {
+        std::printf("Can't read trace %s\n", options.trace_path.c_str());
+        return 2;
+    }
+    return options.command == "dump" ? dump(options, records) : diff(options, records);
+}
@@ -0,0 +1,44 @@
+// Header file for the TripleBuffer
+// Hands whole frames from one producer thread to one consumer thread without locks: the producer always has a slot
+// to draw into, the consumer always has a complete frame to show, and the third slot is swapped between them with a
+// single atomic exchange. Frames the consumer doesn't pick up in time are simply replaced by newer ones
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+template <typename T>
+struct TripleBuffer {
+    // Slots on their own cache lines so the two threads don't fight over one
+    struct alignas(64) Slot {
+        T value{};
+    };
+
+    static constexpr uint8_t INDEX = 0x03;
+    static constexpr uint8_t FRESH = 0x04;      // The middle slot holds a frame the consumer hasn't seen
+
+    std::array<Slot, 3> slots;
+    std::atomic<uint8_t> middle{1};
+    uint8_t back = 0;       // Owned by the producer
+    uint8_t front = 2;      // Owned by the consumer
+
+    // Producer: fill this, then publish()
+    T& write_buffer() { return slots[back].value; }
+    void publish() {
+        back = middle.exchange((uint8_t)(back | FRESH), std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Consumer: swaps in the newest published frame, returns false if there is nothing new since the last call
+    bool update() {
+        if (!(middle.load(std::memory_order_acquire) & FRESH)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& read_buffer() const { return slots[front].value; }
+};
+
+#endif